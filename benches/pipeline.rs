@@ -0,0 +1,179 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use makegen::{cli::Cli, generate, parser::Parser};
+use std::{
+    collections::HashSet,
+    fs,
+    path::PathBuf,
+};
+
+// Shape of a synthetic project tree. `sources` .c files each include
+// `include_fanout` shared header chains, every chain being `chain_depth`
+// headers deep, drawn round-robin from a pool of `shared_headers` chains --
+// so fan-out, depth and header-sharing ratio can be dialed independently.
+struct TreeShape {
+    name: &'static str,
+    sources: usize,
+    shared_headers: usize,
+    include_fanout: usize,
+    chain_depth: usize,
+}
+
+impl TreeShape {
+    fn total_files(&self) -> usize {
+        // All sources, one main file, plus every header of every chain.
+        self.sources + 1 + self.shared_headers * self.chain_depth
+    }
+}
+
+// Materializes the tree under the system temp directory and returns its root.
+// Regenerated from scratch per shape so leftover state cannot leak between
+// benchmark runs.
+fn materialize(shape: &TreeShape) -> PathBuf {
+    let root = std::env::temp_dir().join(format!("makegen_bench_{}", shape.name));
+    let _ = fs::remove_dir_all(&root);
+    fs::create_dir_all(&root).unwrap();
+
+    for chain in 0..shape.shared_headers {
+        for depth in 0..shape.chain_depth {
+            let mut contents = String::new();
+            if depth + 1 < shape.chain_depth {
+                contents.push_str(&format!(
+                    "#include \"shared_{}_{}.h\"\n",
+                    chain,
+                    depth + 1
+                ));
+            }
+            contents.push_str(&format!(
+                "int shared_{}_{}(int x);\n",
+                chain, depth
+            ));
+            fs::write(
+                root.join(format!("shared_{}_{}.h", chain, depth)),
+                contents,
+            )
+            .unwrap();
+        }
+    }
+
+    for source in 0..shape.sources {
+        let mut contents = String::new();
+        for k in 0..shape.include_fanout {
+            let chain = (source + k) % shape.shared_headers;
+            contents.push_str(&format!("#include \"shared_{}_0.h\"\n", chain));
+        }
+        contents.push_str(&format!("int source_{}(int x) {{ return x + 1; }}\n", source));
+        fs::write(root.join(format!("src_{}.c", source)), contents).unwrap();
+    }
+
+    fs::write(
+        root.join("main.c"),
+        "#include \"shared_0_0.h\"\nint main() { return 0; }\n",
+    )
+    .unwrap();
+
+    root
+}
+
+fn bench_cli() -> Cli<'static> {
+    Cli {
+        main_file: "main.c",
+        compiler: "gcc",
+        extension: "c",
+        binary: "bench_bin",
+        standard: "c99",
+        opt_level: "O0",
+        tests: HashSet::new(),
+        benchmarks: HashSet::new(),
+        examples: HashSet::new(),
+        watch: false,
+        timings: None,
+        preamble_scan: false,
+        pattern_rules: false,
+        auto_deps: false,
+        archive_shared: false,
+        unity: None,
+        launcher: None,
+        pch: false,
+        emit_graph: None,
+        roots: Vec::new(),
+        include_dirs: Vec::new(),
+        report_unchanged: false,
+    }
+}
+
+fn bench_pipeline(c: &mut Criterion) {
+    let shapes = [
+        // Wide and shallow: many independent translation units.
+        TreeShape {
+            name: "flat",
+            sources: 200,
+            shared_headers: 40,
+            include_fanout: 3,
+            chain_depth: 1,
+        },
+        // A heavily shared utility-header layer included from everywhere.
+        TreeShape {
+            name: "shared_heavy",
+            sources: 200,
+            shared_headers: 10,
+            include_fanout: 6,
+            chain_depth: 4,
+        },
+        // Few files but deeply nested include chains.
+        TreeShape {
+            name: "deep_chains",
+            sources: 50,
+            shared_headers: 5,
+            include_fanout: 2,
+            chain_depth: 32,
+        },
+    ];
+
+    let cli = bench_cli();
+
+    for shape in &shapes {
+        let root = materialize(shape);
+        // The parser opens files relative to the root, as the CLI does.
+        std::env::set_current_dir(&root).unwrap();
+
+        let mut group = c.benchmark_group("pipeline");
+        group.throughput(Throughput::Elements(shape.total_files() as u64));
+
+        group.bench_with_input(BenchmarkId::new("parse_cold", shape.name), shape, |b, _| {
+            b.iter(|| {
+                let _ = fs::remove_file(root.join(".makegen.cache"));
+                let parser = Parser::new(root.clone(), &cli);
+                parser.parse().unwrap()
+            })
+        });
+
+        group.bench_with_input(BenchmarkId::new("parse_warm", shape.name), shape, |b, _| {
+            let parser = Parser::new(root.clone(), &cli);
+            parser.parse().unwrap(); // prime the on-disk cache
+            b.iter(|| parser.parse().unwrap())
+        });
+
+        let parser = Parser::new(root.clone(), &cli);
+        let parse_result = parser.parse().unwrap();
+
+        group.bench_with_input(BenchmarkId::new("flatten", shape.name), shape, |b, _| {
+            b.iter(|| {
+                generate::flatten_dependencies(
+                    &parse_result.dependency_map,
+                    &parse_result.interner,
+                    cli.extension,
+                    &cli.include_dirs,
+                )
+            })
+        });
+
+        group.bench_with_input(BenchmarkId::new("generate", shape.name), shape, |b, _| {
+            b.iter(|| generate::generate_makefile(&cli, &parse_result, &root).unwrap())
+        });
+
+        group.finish();
+    }
+}
+
+criterion_group!(benches, bench_pipeline);
+criterion_main!(benches);
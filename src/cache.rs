@@ -0,0 +1,218 @@
+use std::{
+    collections::HashMap,
+    fs,
+    io::Write,
+    path::{Path, PathBuf},
+    time::UNIX_EPOCH,
+};
+
+// Bump this whenever the on-disk layout changes; stale formats are discarded.
+// The header also carries the scan configuration that produced the entries --
+// the scan mode, the -I search path and a stamp of the .makegenlibs
+// overrides -- so results from a bounded preamble scan never satisfy a full
+// scan, resolved include edges from one search-path setup never satisfy a
+// run with another, and cached linkage names go stale with the overrides
+// that resolved them.
+const CACHE_FORMAT_HEADER: &str = "# makegen cache v2 mode=";
+const CACHE_FILENAME: &str = ".makegen.cache";
+
+// Separates list items inside a single tab-separated field.
+const LIST_SEPARATOR: char = '\x1f';
+
+// Everything the scanner learns about a single file, keyed by the file's
+// mtime and size so any modification invalidates the entry.
+#[derive(Debug, Clone)]
+pub struct CacheEntry {
+    pub mtime_secs: u64,
+    pub mtime_nanos: u32,
+    pub size: u64,
+    pub has_main: bool,
+    pub includes: Vec<String>,
+    pub dlls: Vec<String>,
+}
+
+impl CacheEntry {
+    pub fn stamp_of(metadata: &fs::Metadata) -> (u64, u32, u64) {
+        let mtime = metadata
+            .modified()
+            .ok()
+            .and_then(|m| m.duration_since(UNIX_EPOCH).ok())
+            .unwrap_or_default();
+
+        (mtime.as_secs(), mtime.subsec_nanos(), metadata.len())
+    }
+
+    fn matches(&self, metadata: &fs::Metadata) -> bool {
+        (self.mtime_secs, self.mtime_nanos, self.size) == Self::stamp_of(metadata)
+    }
+}
+
+// Persistent scan results from previous runs. The cache is loaded once, read
+// concurrently by the scanning workers and written back after the parse, so
+// warm runs only touch files whose stamp changed since the last invocation.
+#[derive(Debug, Default)]
+pub struct ParseCache {
+    entries: HashMap<String, CacheEntry>,
+}
+
+impl ParseCache {
+    pub fn load(
+        root_dir: &Path,
+        scan_mode: &str,
+        include_dirs: &[&str],
+        libs_stamp: &str,
+    ) -> Self {
+        let contents = match fs::read_to_string(Self::cache_path(root_dir)) {
+            Ok(contents) => contents,
+            Err(_) => return Self::default(),
+        };
+
+        let mut lines = contents.lines();
+        if lines.next() != Some(&Self::header(scan_mode, include_dirs, libs_stamp)) {
+            return Self::default();
+        }
+
+        let mut entries = HashMap::new();
+        for line in lines {
+            if let Some((path, entry)) = Self::parse_line(line) {
+                entries.insert(path, entry);
+            }
+        }
+
+        Self { entries }
+    }
+
+    pub fn lookup(&self, path: &str, metadata: &fs::Metadata) -> Option<&CacheEntry> {
+        self.entries
+            .get(path)
+            .filter(|entry| entry.matches(metadata))
+    }
+
+    pub fn insert(&mut self, path: String, entry: CacheEntry) {
+        self.entries.insert(path, entry);
+    }
+
+    pub fn merge(&mut self, other: Self) {
+        self.entries.extend(other.entries);
+    }
+
+    pub fn store(
+        &self,
+        root_dir: &Path,
+        scan_mode: &str,
+        include_dirs: &[&str],
+        libs_stamp: &str,
+    ) -> std::io::Result<()> {
+        let mut buffer = String::new();
+        buffer.push_str(&Self::header(scan_mode, include_dirs, libs_stamp));
+        buffer.push('\n');
+
+        for (path, entry) in &self.entries {
+            buffer.push_str(&format!(
+                "{}\t{}\t{}\t{}\t{}\t{}\t{}\n",
+                path,
+                entry.mtime_secs,
+                entry.mtime_nanos,
+                entry.size,
+                entry.has_main as u8,
+                Self::join_list(&entry.includes),
+                Self::join_list(&entry.dlls),
+            ));
+        }
+
+        let mut file = fs::File::create(Self::cache_path(root_dir))?;
+        file.write_all(buffer.as_bytes())
+    }
+
+    fn cache_path(root_dir: &Path) -> PathBuf {
+        root_dir.join(CACHE_FILENAME)
+    }
+
+    fn header(scan_mode: &str, include_dirs: &[&str], libs_stamp: &str) -> String {
+        let mut header = format!("{}{} libs={}", CACHE_FORMAT_HEADER, scan_mode, libs_stamp);
+        for dir in include_dirs {
+            header.push(LIST_SEPARATOR);
+            header.push_str(dir);
+        }
+        header
+    }
+
+    fn parse_line(line: &str) -> Option<(String, CacheEntry)> {
+        let mut fields = line.split('\t');
+
+        let path = fields.next()?.to_string();
+        let entry = CacheEntry {
+            mtime_secs: fields.next()?.parse().ok()?,
+            mtime_nanos: fields.next()?.parse().ok()?,
+            size: fields.next()?.parse().ok()?,
+            has_main: fields.next()? == "1",
+            includes: Self::split_list(fields.next()?),
+            dlls: Self::split_list(fields.next()?),
+        };
+
+        Some((path, entry))
+    }
+
+    fn join_list(list: &[String]) -> String {
+        list.join(&LIST_SEPARATOR.to_string())
+    }
+
+    fn split_list(field: &str) -> Vec<String> {
+        field
+            .split(LIST_SEPARATOR)
+            .filter(|s| !s.is_empty())
+            .map(str::to_string)
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn cache_round_trips_through_disk() {
+        let root = std::env::temp_dir().join("makegen_cache_test");
+        fs::create_dir_all(&root).unwrap();
+
+        let mut cache = ParseCache::default();
+        cache.insert(
+            "main.c".to_string(),
+            CacheEntry {
+                mtime_secs: 42,
+                mtime_nanos: 7,
+                size: 128,
+                has_main: true,
+                includes: vec!["util.h".to_string(), "sub/other.h".to_string()],
+                dlls: vec!["m".to_string()],
+            },
+        );
+
+        cache.store(&root, "full", &["include"], "none").unwrap();
+        let reloaded = ParseCache::load(&root, "full", &["include"], "none");
+        assert!(ParseCache::load(&root, "preamble", &["include"], "none")
+            .entries
+            .is_empty());
+        // A different -I configuration resolves includes differently, so it
+        // must miss too.
+        assert!(ParseCache::load(&root, "full", &[], "none").entries.is_empty());
+        assert!(ParseCache::load(&root, "full", &["other"], "none")
+            .entries
+            .is_empty());
+        // Same for a changed .makegenlibs: the cached dlls were resolved
+        // through the old overrides.
+        assert!(ParseCache::load(&root, "full", &["include"], "1.2.3")
+            .entries
+            .is_empty());
+
+        let entry = reloaded.entries.get("main.c").unwrap();
+        assert_eq!(entry.mtime_secs, 42);
+        assert_eq!(entry.mtime_nanos, 7);
+        assert_eq!(entry.size, 128);
+        assert!(entry.has_main);
+        assert_eq!(entry.includes, vec!["util.h", "sub/other.h"]);
+        assert_eq!(entry.dlls, vec!["m"]);
+
+        fs::remove_dir_all(&root).unwrap();
+    }
+}
@@ -1,3 +1,4 @@
+use crate::{graph, timings::TimingsFormat};
 use clap::ArgMatches;
 use std::collections::HashSet;
 
@@ -11,6 +12,19 @@ pub struct Cli<'cli> {
     pub tests: HashSet<&'cli str>,
     pub benchmarks: HashSet<&'cli str>,
     pub examples: HashSet<&'cli str>,
+    pub watch: bool,
+    pub timings: Option<TimingsFormat>,
+    pub preamble_scan: bool,
+    pub pattern_rules: bool,
+    pub auto_deps: bool,
+    pub archive_shared: bool,
+    pub unity: Option<usize>,
+    pub launcher: Option<&'cli str>,
+    pub pch: bool,
+    pub emit_graph: Option<&'cli str>,
+    pub roots: Vec<&'cli str>,
+    pub include_dirs: Vec<&'cli str>,
+    pub report_unchanged: bool,
 }
 
 impl<'cli> Cli<'cli> {
@@ -43,6 +57,55 @@ impl<'cli> Cli<'cli> {
 
         let examples: HashSet<_> = matches.values_of("examples").unwrap().collect();
 
+        let watch = matches.is_present("watch");
+
+        let preamble_scan = matches.is_present("preamble_scan");
+
+        let pattern_rules = matches.is_present("pattern_rules");
+
+        let auto_deps = matches.is_present("auto_deps");
+
+        let archive_shared = matches.is_present("archive_shared");
+
+        let unity = match matches.value_of("unity") {
+            Some(value) => match value.parse::<usize>() {
+                Ok(n) if n >= 2 => Some(n),
+                _ => return Err("The unity batch size must be an integer of at least 2"),
+            },
+            None => None,
+        };
+
+        let launcher = matches.value_of("launcher");
+
+        let pch = matches.is_present("pch");
+
+        let roots: Vec<_> = matches
+            .values_of("roots")
+            .map(|values| values.collect())
+            .unwrap_or_default();
+
+        let include_dirs: Vec<_> = matches
+            .values_of("include_dirs")
+            .map(|values| values.collect())
+            .unwrap_or_default();
+
+        let report_unchanged = matches.is_present("report_unchanged");
+
+        let emit_graph = if matches.is_present("emit_graph") {
+            Some(matches.value_of("emit_graph").unwrap_or(graph::GRAPH_FILENAME))
+        } else {
+            None
+        };
+
+        let timings = if matches.is_present("timings") {
+            match matches.value_of("timings") {
+                Some("json") => Some(TimingsFormat::Json),
+                _ => Some(TimingsFormat::Text),
+            }
+        } else {
+            None
+        };
+
         Ok(Self {
             binary,
             main_file,
@@ -53,6 +116,19 @@ impl<'cli> Cli<'cli> {
             tests,
             benchmarks,
             examples,
+            watch,
+            timings,
+            preamble_scan,
+            pattern_rules,
+            auto_deps,
+            archive_shared,
+            unity,
+            launcher,
+            pch,
+            emit_graph,
+            roots,
+            include_dirs,
+            report_unchanged,
         })
     }
 }
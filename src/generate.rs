@@ -1,15 +1,32 @@
 use crate::{
     cli::Cli,
     filename_utils::*,
+    intern::{FileId, PathInterner},
     parser::{DependencyMap, ParseResult},
+    timings,
+};
+use rayon::prelude::*;
+use std::{
+    collections::{HashMap, HashSet},
+    sync::Arc,
 };
-use std::{collections::HashSet, fs::File, io::prelude::*};
 
 struct GenerateContext<'c, 'p, 'd> {
     cli: &'c Cli<'c>,
-    partitioned: &'p PartitionedFiles<'p>,
+    partitioned: &'p PartitionedFiles,
     dep_map: &'d DependencyMap,
     dlls: &'d Vec<String>,
+    interner: &'d PathInterner,
+    // Precomputed per-file names; every emitter indexes this instead of
+    // re-deriving strings.
+    records: &'d FileRecords,
+    // Objects pulled into the common static archive (empty unless
+    // --archive-shared found any).
+    archived: &'d HashSet<FileId>,
+    // Unity batching plan when --unity is active.
+    unity: Option<&'d UnityPlan>,
+    // The header precompiled by --pch, when one qualifies.
+    pch: Option<FileId>,
 }
 
 impl<'c, 'p, 'd> GenerateContext<'c, 'p, 'd> {
@@ -18,62 +35,227 @@ impl<'c, 'p, 'd> GenerateContext<'c, 'p, 'd> {
         partitioned: &'p PartitionedFiles,
         dep_map: &'d DependencyMap,
         dlls: &'d Vec<String>,
+        interner: &'d PathInterner,
+        records: &'d FileRecords,
+        archived: &'d HashSet<FileId>,
+        unity: Option<&'d UnityPlan>,
+        pch: Option<FileId>,
     ) -> Self {
         Self {
             cli,
             partitioned,
             dep_map,
             dlls,
+            interner,
+            records,
+            archived,
+            unity,
+            pch,
+        }
+    }
+}
+
+// Per-file naming table built once per render. Every derived string the
+// emitters need -- the extension-less stem, the folder-escaped object name
+// and the uppercased variable-name prefix -- is formatted a single time into
+// one shared arena, instead of being re-derived in generate_file_variables,
+// in generate_targets and once more per binary that links the file. The
+// sources are kept in path order, which also pins down the emission order of
+// every per-file loop regardless of hash-map iteration.
+struct FileRecords {
+    arena: String,
+    spans: HashMap<FileId, RecordSpans>,
+    // Every source file of the flattened map, sorted by path.
+    sources: Vec<FileId>,
+    pattern_rules: bool,
+}
+
+// Byte ranges into the FileRecords arena.
+#[derive(Clone, Copy)]
+struct RecordSpans {
+    stem: (u32, u32),
+    escaped: (u32, u32),
+    var_stem: (u32, u32),
+}
+
+impl FileRecords {
+    fn build(dep_map: &DependencyMap, interner: &PathInterner, pattern_rules: bool) -> Self {
+        let mut sources: Vec<FileId> = dep_map.keys().copied().collect();
+        sources.sort_by_key(|&file| interner.resolve(file));
+
+        let mut arena = String::with_capacity(sources.len() * 48);
+        let mut spans = HashMap::with_capacity(sources.len());
+        for &file in &sources {
+            let stem_str = strip_extension(interner.resolve(file));
+
+            let stem = record_span(&mut arena, |arena| arena.push_str(stem_str));
+            let escaped = record_span(&mut arena, |arena| push_escaped(arena, stem_str));
+            let var_stem = record_span(&mut arena, |arena| {
+                for c in stem_str.chars() {
+                    arena.push(if c == '/' { '_' } else { c.to_ascii_uppercase() });
+                }
+            });
+
+            spans.insert(
+                file,
+                RecordSpans {
+                    stem,
+                    escaped,
+                    var_stem,
+                },
+            );
+        }
+
+        Self {
+            arena,
+            spans,
+            sources,
+            pattern_rules,
+        }
+    }
+
+    fn span(&self, (start, len): (u32, u32)) -> &str {
+        &self.arena[start as usize..(start + len) as usize]
+    }
+
+    fn stem(&self, file: FileId) -> &str {
+        self.span(self.spans[&file].stem)
+    }
+
+    fn escaped(&self, file: FileId) -> &str {
+        self.span(self.spans[&file].escaped)
+    }
+
+    // "<ESCAPED_UPPERCASED_STEM>"; callers append "_SOURCE_DEPS" and friends.
+    fn var_stem(&self, file: FileId) -> &str {
+        self.span(self.spans[&file].var_stem)
+    }
+
+    // Object files mirror the source directory layout in pattern-rule mode
+    // (so the %.o: %.<ext> stem lines up); otherwise folders are flattened
+    // into the object name as the explicit rules have always done.
+    fn object_stem(&self, file: FileId) -> &str {
+        if self.pattern_rules {
+            self.stem(file)
+        } else {
+            self.escaped(file)
         }
     }
+
+    // None for files without a record -- headers never have objects.
+    fn try_object_stem(&self, file: FileId) -> Option<&str> {
+        self.spans.get(&file).map(|spans| {
+            self.span(if self.pattern_rules {
+                spans.stem
+            } else {
+                spans.escaped
+            })
+        })
+    }
 }
 
-struct PartitionedFiles<'f> {
-    standalone: Vec<&'f str>,
-    tests: Vec<&'f str>,
-    benchmarks: Vec<&'f str>,
-    examples: Vec<&'f str>,
+fn record_span(arena: &mut String, write: impl FnOnce(&mut String)) -> (u32, u32) {
+    let start = arena.len();
+    write(arena);
+    (start as u32, (arena.len() - start) as u32)
 }
 
-impl<'f> PartitionedFiles<'f> {
-    pub fn partition(cli: &Cli, map: &'f DependencyMap) -> Self {
-        macro_rules! contained_in_partition {
-            ($cli:ident, $partition:ident, $running:ident) => {
-                $cli.$partition.iter().any(|f| {
-                    let f = self::strip_extension(f);
-                    $running.starts_with(f) || **$running == f
-                })
+struct PartitionedFiles {
+    standalone: Vec<FileId>,
+    tests: Vec<FileId>,
+    benchmarks: Vec<FileId>,
+    examples: Vec<FileId>,
+}
+
+// Byte trie over the partition entries from the command line. Classifying a
+// file is a single walk over its path bytes, instead of a starts_with against
+// every entry of every partition set.
+#[derive(Debug, Default)]
+struct PrefixTrie {
+    children: HashMap<u8, PrefixTrie>,
+    terminal: bool,
+}
+
+impl PrefixTrie {
+    fn from_partition_entries<'e>(entries: impl Iterator<Item = &'e str>) -> Self {
+        let mut trie = Self::default();
+        for entry in entries {
+            trie.insert(strip_extension(entry));
+        }
+        trie
+    }
+
+    fn insert(&mut self, key: &str) {
+        let mut node = self;
+        for &byte in key.as_bytes() {
+            node = node.children.entry(byte).or_default();
+        }
+        node.terminal = true;
+    }
+
+    // True when any inserted entry is a prefix of (or equal to) the path.
+    fn matches_prefix_of(&self, path: &str) -> bool {
+        let mut node = self;
+        if node.terminal {
+            return true;
+        }
+
+        for &byte in path.as_bytes() {
+            node = match node.children.get(&byte) {
+                Some(child) => child,
+                None => return false,
             };
+            if node.terminal {
+                return true;
+            }
         }
 
-        let with_main: Vec<_> = map
-            .keys()
-            .filter(|k| map.get(*k).unwrap().1) // filter those which contain a main function
-            .map(|k| strip_extension(k.as_str()))
-            .collect();
+        false
+    }
+}
 
-        let tests: Vec<_> = with_main
-            .iter()
-            .filter(|v| contained_in_partition!(cli, tests, v))
-            .map(|v| *v)
-            .collect();
+impl PartitionedFiles {
+    pub fn partition(cli: &Cli, map: &DependencyMap, interner: &PathInterner) -> Self {
+        let test_index = PrefixTrie::from_partition_entries(cli.tests.iter().copied());
+        let benchmark_index = PrefixTrie::from_partition_entries(cli.benchmarks.iter().copied());
+        let example_index = PrefixTrie::from_partition_entries(cli.examples.iter().copied());
 
-        let benchmarks: Vec<_> = with_main
-            .iter()
-            .filter(|v| contained_in_partition!(cli, benchmarks, v))
-            .map(|v| *v)
-            .collect();
+        let mut standalone = Vec::new();
+        let mut tests = Vec::new();
+        let mut benchmarks = Vec::new();
+        let mut examples = Vec::new();
 
-        let examples: Vec<_> = with_main
-            .iter()
-            .filter(|v| contained_in_partition!(cli, examples, v))
-            .map(|v| *v)
-            .collect();
+        // Each file with a main function is classified with one O(path
+        // length) probe per partition; anything unclaimed is standalone.
+        for &id in map
+            .keys()
+            .filter(|k| map.get(*k).unwrap().1) // filter those which contain a main function
+        {
+            let file = strip_extension(interner.resolve(id));
+            let mut claimed = false;
+            if test_index.matches_prefix_of(file) {
+                tests.push(id);
+                claimed = true;
+            }
+            if benchmark_index.matches_prefix_of(file) {
+                benchmarks.push(id);
+                claimed = true;
+            }
+            if example_index.matches_prefix_of(file) {
+                examples.push(id);
+                claimed = true;
+            }
+            if !claimed {
+                standalone.push(id);
+            }
+        }
 
-        let standalone: Vec<_> = with_main
-            .into_iter()
-            .filter(|v| !tests.contains(v) && !benchmarks.contains(v) && !examples.contains(v))
-            .collect();
+        // Path order, so the emitted target lists and link rules are stable
+        // across runs regardless of hash-map iteration order.
+        standalone.sort_by_key(|&id| interner.resolve(id));
+        tests.sort_by_key(|&id| interner.resolve(id));
+        benchmarks.sort_by_key(|&id| interner.resolve(id));
+        examples.sort_by_key(|&id| interner.resolve(id));
 
         Self {
             standalone,
@@ -84,297 +266,1283 @@ impl<'f> PartitionedFiles<'f> {
     }
 }
 
-fn get_all_file_dependencies(file: &str, ext: &str, dep_map: &DependencyMap) -> Vec<String> {
-    let mut seen = HashSet::new();
-    let mut file_deps = Vec::new();
-    get_all_file_dependencies_r(file, ext, dep_map, &mut seen, &mut file_deps);
-    file_deps
-}
-
-fn get_all_file_dependencies_r(
-    file: &str,
+// The edges the closure follows: the recorded include edges plus the
+// complementary source/header of each dependency, restricted to files that
+// were actually parsed into the map.
+fn effective_neighbors(
+    file: FileId,
     ext: &str,
     dep_map: &DependencyMap,
-    seen: &mut HashSet<String>,
-    file_deps: &mut Vec<String>,
-) {
-    if dep_map.contains_key(file) {
-        file_deps.push(file.to_owned());
-        seen.insert(file.to_owned());
-
-        let dependencies = &dep_map.get(file).unwrap().0;
-        for dependency in dependencies {
-            if !seen.contains(dependency) {
-                get_all_file_dependencies_r(dependency, ext, dep_map, seen, file_deps);
+    interner: &PathInterner,
+    include_dirs: &[&str],
+) -> Vec<FileId> {
+    let file_path = interner.resolve(file);
+    let file_dir = &file_path[..file_path.rfind('/').map_or(0, |at| at)];
+    let mut neighbors = Vec::new();
+
+    for &dependency in &dep_map.get(&file).unwrap().0 {
+        if dep_map.contains_key(&dependency) {
+            neighbors.push(dependency);
+        }
+
+        let dependency_path = interner.resolve(dependency);
+        let stripped = strip_extension(dependency_path);
+        let suffix = if has_extension(dependency_path, ext) {
+            "h"
+        } else {
+            ext
+        };
+
+        // Sibling of the dependency itself first; when the dependency lives
+        // in a separate -I directory its complement sits elsewhere, so fall
+        // back to probing by basename through the same search path include
+        // resolution uses -- the includer's directory, then each -I dir.
+        let complementary = lookup_parsed(&format!("{}.{}", stripped, suffix), dep_map, interner)
+            .or_else(|| {
+                let basename = stripped.rsplit('/').next().unwrap();
+                std::iter::once(file_dir)
+                    .chain(include_dirs.iter().copied())
+                    .find_map(|dir| {
+                        let candidate = if dir.is_empty() {
+                            format!("{}.{}", basename, suffix)
+                        } else {
+                            format!("{}/{}.{}", dir, basename, suffix)
+                        };
+                        lookup_parsed(&candidate, dep_map, interner)
+                    })
+            });
+
+        if let Some(complementary_id) = complementary {
+            neighbors.push(complementary_id);
+        }
+    }
+
+    neighbors
+}
+
+// The file's id when it was parsed into the map, None otherwise.
+fn lookup_parsed(path: &str, dep_map: &DependencyMap, interner: &PathInterner) -> Option<FileId> {
+    interner.get(path).filter(|id| dep_map.contains_key(id))
+}
+
+// Strongly-connected-component discovery over the precomputed adjacency.
+// Tarjan's algorithm (run iteratively so deep include chains cannot exhaust
+// the stack) pops components in reverse topological order -- dependencies
+// first -- which is what lets the closure assembly below run level-parallel.
+// The walk itself is inherently sequential but linear; it only records the
+// components, leaving the expensive closure merging to the thread pool.
+struct ClosureBuilder<'d> {
+    neighbors: &'d HashMap<FileId, Vec<FileId>>,
+    index: HashMap<FileId, u32>,
+    lowlink: HashMap<FileId, u32>,
+    next_index: u32,
+    stack: Vec<FileId>,
+    on_stack: HashSet<FileId>,
+    component_of: HashMap<FileId, u32>,
+    components: Vec<Vec<FileId>>,
+}
+
+struct VisitFrame<'d> {
+    node: FileId,
+    neighbors: &'d [FileId],
+    next_neighbor: usize,
+}
+
+impl<'d> ClosureBuilder<'d> {
+    fn new(neighbors: &'d HashMap<FileId, Vec<FileId>>) -> Self {
+        Self {
+            neighbors,
+            index: HashMap::new(),
+            lowlink: HashMap::new(),
+            next_index: 0,
+            stack: Vec::new(),
+            on_stack: HashSet::new(),
+            component_of: HashMap::new(),
+            components: Vec::new(),
+        }
+    }
+
+    fn build(mut self) -> (HashMap<FileId, u32>, Vec<Vec<FileId>>) {
+        let roots: Vec<_> = self.neighbors.keys().copied().collect();
+        for root in roots {
+            if !self.index.contains_key(&root) {
+                self.visit(root);
             }
+        }
 
-            let stripped = strip_extension(dependency);
-            let complementary_file = if has_extension(dependency, ext) {
-                format!("{}.h", stripped)
+        (self.component_of, self.components)
+    }
+
+    fn visit(&mut self, root: FileId) {
+        let mut frames = vec![self.open_frame(root)];
+
+        while let Some(frame) = frames.last_mut() {
+            if frame.next_neighbor < frame.neighbors.len() {
+                let neighbor = frame.neighbors[frame.next_neighbor];
+                frame.next_neighbor += 1;
+
+                if !self.index.contains_key(&neighbor) {
+                    let next_frame = self.open_frame(neighbor);
+                    frames.push(next_frame);
+                } else if self.on_stack.contains(&neighbor) {
+                    let neighbor_index = self.index[&neighbor];
+                    let node = frame.node;
+                    let lowlink = self.lowlink.get_mut(&node).unwrap();
+                    *lowlink = (*lowlink).min(neighbor_index);
+                }
             } else {
-                format!("{}.{}", stripped, ext)
-            };
+                let node = frame.node;
+                frames.pop();
+
+                if let Some(parent) = frames.last() {
+                    let node_lowlink = self.lowlink[&node];
+                    let parent_lowlink = self.lowlink.get_mut(&parent.node).unwrap();
+                    *parent_lowlink = (*parent_lowlink).min(node_lowlink);
+                }
+
+                if self.lowlink[&node] == self.index[&node] {
+                    self.finish_component(node);
+                }
+            }
+        }
+    }
+
+    fn open_frame(&mut self, node: FileId) -> VisitFrame<'d> {
+        self.index.insert(node, self.next_index);
+        self.lowlink.insert(node, self.next_index);
+        self.next_index += 1;
+        self.stack.push(node);
+        self.on_stack.insert(node);
+
+        let neighbors = self.neighbors;
+        VisitFrame {
+            node,
+            neighbors: &neighbors[&node],
+            next_neighbor: 0,
+        }
+    }
 
-            if dep_map.contains_key(&complementary_file) && !seen.contains(&complementary_file) {
-                get_all_file_dependencies_r(&complementary_file, ext, dep_map, seen, file_deps);
-                // file_deps.push(complementary_file);
+    // Pops the finished component off the Tarjan stack and records it; its
+    // index in `components` is higher than every component it reaches.
+    fn finish_component(&mut self, root: FileId) {
+        let mut members = Vec::new();
+        loop {
+            let member = self.stack.pop().unwrap();
+            self.on_stack.remove(&member);
+            self.component_of.insert(member, self.components.len() as u32);
+            members.push(member);
+            if member == root {
+                break;
             }
         }
+
+        self.components.push(members);
+    }
+}
+
+// Assembles one closure per component, across the thread pool. Components
+// are grouped into levels by their longest successor chain; every component
+// of a level depends only on closures finished on earlier levels, so the
+// components within a level are independent and merge in parallel. Every
+// member of a component shares one Arc'd closure, instead of each file
+// re-walking the shared subgraph with a fresh seen set.
+fn assemble_closures(
+    components: &[Vec<FileId>],
+    component_of: &HashMap<FileId, u32>,
+    neighbors: &HashMap<FileId, Vec<FileId>>,
+) -> Vec<Arc<Vec<FileId>>> {
+    // Successor lists and levels come from one sequential pass; components
+    // arrive dependencies-first, so successor levels are already known.
+    let mut successors: Vec<Vec<u32>> = Vec::with_capacity(components.len());
+    let mut level_of: Vec<u32> = Vec::with_capacity(components.len());
+    for (component, members) in components.iter().enumerate() {
+        let mut successor_components = Vec::new();
+        let mut level = 0;
+        for &member in members {
+            for &neighbor in &neighbors[&member] {
+                let neighbor_component = component_of[&neighbor];
+                if neighbor_component as usize != component {
+                    level = level.max(level_of[neighbor_component as usize] + 1);
+                    successor_components.push(neighbor_component);
+                }
+            }
+        }
+        successor_components.sort_unstable();
+        successor_components.dedup();
+        successors.push(successor_components);
+        level_of.push(level);
+    }
+
+    let level_count = level_of.iter().max().map_or(0, |&level| level as usize + 1);
+    let mut levels: Vec<Vec<u32>> = vec![Vec::new(); level_count];
+    for (component, &level) in level_of.iter().enumerate() {
+        levels[level as usize].push(component as u32);
+    }
+
+    let mut closures: Vec<Arc<Vec<FileId>>> = vec![Arc::new(Vec::new()); components.len()];
+    for level in levels {
+        let finished: Vec<(u32, Arc<Vec<FileId>>)> = level
+            .par_iter()
+            .map(|&component| {
+                let members = &components[component as usize];
+                let mut closure = Vec::new();
+                let mut seen = HashSet::new();
+                for &member in members {
+                    if seen.insert(member) {
+                        closure.push(member);
+                    }
+                }
+
+                for &successor in &successors[component as usize] {
+                    for &reachable in closures[successor as usize].iter() {
+                        if seen.insert(reachable) {
+                            closure.push(reachable);
+                        }
+                    }
+                }
+
+                (component, Arc::new(closure))
+            })
+            .collect();
+
+        for (component, closure) in finished {
+            closures[component as usize] = closure;
+        }
+    }
+
+    closures
+}
+
+pub fn flatten_dependencies(
+    dep_map: &DependencyMap,
+    interner: &PathInterner,
+    ext: &str,
+    include_dirs: &[&str],
+) -> DependencyMap {
+    // The adjacency is computed once up front, partitioned across the pool;
+    // effective_neighbors is read-only over the parsed map.
+    let neighbors: HashMap<FileId, Vec<FileId>> = dep_map
+        .par_iter()
+        .map(|(&file, _)| {
+            (
+                file,
+                effective_neighbors(file, ext, dep_map, interner, include_dirs),
+            )
+        })
+        .collect();
+
+    let (component_of, components) = ClosureBuilder::new(&neighbors).build();
+    let closures = assemble_closures(&components, &component_of, &neighbors);
+
+    dep_map
+        .par_iter()
+        .filter(|(&file, _)| has_extension(interner.resolve(file), ext))
+        .map(|(&file, entry)| {
+            let closure = &closures[component_of[&file] as usize];
+            let mut file_deps = Vec::with_capacity(closure.len());
+            file_deps.push(file);
+            file_deps.extend(closure.iter().copied().filter(|&d| d != file));
+            // Closure contents arrive in discovery order, which follows
+            // hash-map iteration and varies run to run; path order makes
+            // the emitted dependency lists byte-stable so an unchanged
+            // Makefile compares equal to the one on disk.
+            file_deps[1..].sort_unstable_by_key(|&d| interner.resolve(d));
+
+            (file, (file_deps, entry.1))
+        })
+        .collect()
+}
+
+// Rough bytes emitted per dependency-map entry (two variable lines plus a
+// rule); only used to size the emission buffers so the hot loops append
+// without reallocating.
+const ESTIMATED_BYTES_PER_FILE: usize = 256;
+
+// Files rendered per worker task. Large enough that a task amortizes its
+// buffer allocation, small enough to keep all cores busy on a 10k-file tree.
+const FILES_PER_RENDER_CHUNK: usize = 256;
+
+// Runs the per-file renderer over chunks of the file list in parallel, each
+// chunk appending to its own buffer, and splices the chunks back in list
+// order -- the output is byte-identical to running the renderer serially.
+fn render_file_chunks<F>(buffer: &mut String, ctx: &GenerateContext, files: &[FileId], render: F)
+where
+    F: Fn(&mut String, FileId, &GenerateContext) + Sync,
+{
+    let chunks: Vec<String> = files
+        .par_chunks(FILES_PER_RENDER_CHUNK)
+        .map(|chunk| {
+            let mut chunk_buffer =
+                String::with_capacity(chunk.len() * ESTIMATED_BYTES_PER_FILE);
+            for &file in chunk {
+                render(&mut chunk_buffer, file, ctx);
+            }
+            chunk_buffer
+        })
+        .collect();
+
+    for chunk in &chunks {
+        buffer.push_str(chunk);
     }
 }
 
-fn flatten_dependencies(dep_map: &DependencyMap, ext: &str) -> DependencyMap {
-    let mut new_dep_map = DependencyMap::new();
+// Returns whether the Makefile was actually (re)written. The render is
+// deterministic, so when the content matches what is already on disk the
+// write is skipped entirely -- rewriting identical bytes would bump the
+// mtime and retrigger everything downstream that keys off it.
+pub fn generate_makefile(
+    cli: &Cli,
+    parse_result: &ParseResult,
+    root_dir: &std::path::Path,
+) -> std::io::Result<bool> {
+    let dep_map = timings::time_phase("flatten", || {
+        flatten_dependencies(
+            &parse_result.dependency_map,
+            &parse_result.interner,
+            cli.extension,
+            &cli.include_dirs,
+        )
+    });
+    let buffer = render_makefile(cli, parse_result, &dep_map, root_dir)?;
 
-    for file in dep_map.keys().filter(|f| has_extension(f, ext)) {
-        let file_deps = get_all_file_dependencies(file, ext, &dep_map);
-        let has_main = dep_map.get(file).unwrap().1;
-        new_dep_map.insert(file.to_owned(), (file_deps, has_main));
+    if let Some(path) = cli.emit_graph {
+        timings::time_phase("graph export", || {
+            crate::graph::write_graph(&root_dir.join(path), &dep_map, &parse_result.interner)
+        })?;
     }
 
-    new_dep_map
+    timings::time_phase("write", || {
+        let path = root_dir.join("Makefile");
+        match std::fs::read(&path) {
+            Ok(existing) if existing == buffer.as_bytes() => {
+                timings::record_unchanged_makefile();
+                Ok(false)
+            }
+            _ => {
+                std::fs::write(path, buffer.as_bytes())?;
+                Ok(true)
+            }
+        }
+    })
 }
 
-pub fn generate_makefile(cli: &Cli, parse_result: ParseResult) -> std::io::Result<()> {
-    let mut makefile = File::create("Makefile")?;
-    let dep_map = flatten_dependencies(&parse_result.dependency_map, cli.extension);
-    let partitioned = PartitionedFiles::partition(cli, &parse_result.dependency_map);
-    let ctx = GenerateContext::new(cli, &partitioned, &dep_map, &parse_result.dlls);
+// Renders the complete Makefile into a single in-memory buffer from the
+// already flattened map (the caller flattens once and shares the map with
+// the graph export). The emitters below append to the buffer directly -- no
+// per-line syscalls, and no intermediate Vec<String> + join allocations on
+// the per-file loops -- and the caller flushes the whole thing with one
+// write.
+pub fn render_makefile(
+    cli: &Cli,
+    parse_result: &ParseResult,
+    dep_map: &DependencyMap,
+    root_dir: &std::path::Path,
+) -> std::io::Result<String> {
+    let interner = &parse_result.interner;
+    let partitioned = PartitionedFiles::partition(cli, &parse_result.dependency_map, interner);
+    // Unity batching supersedes archive grouping: batched sources no longer
+    // have per-file objects for an archive to collect.
+    let archived = if cli.archive_shared && cli.unity.is_none() {
+        shared_objects(dep_map, interner, cli.extension)
+    } else {
+        HashSet::new()
+    };
+    let unity = match cli.unity {
+        Some(batch_size) => {
+            let plan = UnityPlan::build(batch_size, dep_map, interner);
+            plan.write_sources(root_dir, interner, cli.extension)?;
+            Some(plan)
+        }
+        None => None,
+    };
+    let pch = if cli.pch {
+        pch_header(dep_map, interner, cli.extension)
+    } else {
+        None
+    };
+    let records = timings::time_phase("records", || {
+        FileRecords::build(dep_map, interner, cli.pattern_rules)
+    });
+    let ctx = GenerateContext::new(
+        cli,
+        &partitioned,
+        dep_map,
+        &parse_result.dlls,
+        interner,
+        &records,
+        &archived,
+        unity.as_ref(),
+        pch,
+    );
+
+    Ok(timings::time_phase("emission", || {
+        // The sections only read the shared context once the flattened map
+        // exists, so each renders into its own buffer on the pool (and the
+        // per-file loops inside them chunk across it); concatenating in
+        // order keeps the output byte-identical to a serial render.
+        let (compiler_section, (file_section, target_section)) = rayon::join(
+            || {
+                let mut buffer = String::new();
+                generate_compiler_variables(&mut buffer, &ctx);
+                buffer
+            },
+            || {
+                rayon::join(
+                    || {
+                        let mut buffer = String::new();
+                        generate_file_variables(&mut buffer, &ctx);
+                        buffer
+                    },
+                    || {
+                        let mut buffer = String::new();
+                        generate_targets(&mut buffer, &ctx);
+                        buffer
+                    },
+                )
+            },
+        );
+
+        let mut buffer = String::with_capacity(
+            compiler_section.len() + file_section.len() + target_section.len(),
+        );
+        buffer.push_str(&compiler_section);
+        buffer.push_str(&file_section);
+        buffer.push_str(&target_section);
+        buffer
+    }))
+}
 
-    generate_compiler_variables(&mut makefile, &ctx)?;
-    generate_file_variables(&mut makefile, &ctx)?;
-    generate_targets(&mut makefile, &ctx)?;
+const UNITY_DIR: &str = ".makegen_unity";
 
-    Ok(())
+// Groups non-main sources into unity (jumbo) translation units of up to
+// batch_size files each, so shared headers are parsed once per batch instead
+// of once per file. Sources with a main function are never batched -- each
+// defines its own entry point -- and batches are filled in path order so the
+// generated TUs are stable across runs and only changed batches recompile.
+struct UnityPlan {
+    batches: Vec<Vec<FileId>>,
+    batch_of: HashMap<FileId, usize>,
 }
 
-fn generate_compiler_variables(makefile: &mut File, ctx: &GenerateContext) -> std::io::Result<()> {
-    writeln!(
-        makefile,
-        "CC := {compiler}\n\
-        CFLAGS := -Wall\n\
-        CFLAGS += -std={std}\n\
-        CFLAGS += -{opt}\n\
-        LFLAGS := {link_flags}",
-        compiler = ctx.cli.compiler,
-        std = ctx.cli.standard,
-        opt = ctx.cli.opt_level,
-        link_flags = ctx
-            .dlls
+impl UnityPlan {
+    fn build(batch_size: usize, dep_map: &DependencyMap, interner: &PathInterner) -> Self {
+        let mut helpers: Vec<FileId> = dep_map
             .iter()
-            .map(|dll| format!("-l{}", dll))
-            .collect::<Vec<_>>()
-            .join(" ")
-    )?;
+            .filter(|(_, entry)| !entry.1)
+            .map(|(&file, _)| file)
+            .collect();
+        helpers.sort_by_key(|&file| interner.resolve(file));
+
+        let mut batches = Vec::new();
+        let mut batch_of = HashMap::new();
+        for chunk in helpers.chunks(batch_size) {
+            for &file in chunk {
+                batch_of.insert(file, batches.len());
+            }
+            batches.push(chunk.to_vec());
+        }
+
+        Self { batches, batch_of }
+    }
+
+    // Each unity source #includes its member files through a ../ path, so
+    // the members' own quoted includes still resolve against their real
+    // locations.
+    fn write_sources(
+        &self,
+        root_dir: &std::path::Path,
+        interner: &PathInterner,
+        ext: &str,
+    ) -> std::io::Result<()> {
+        if self.batches.is_empty() {
+            return Ok(());
+        }
+
+        std::fs::create_dir_all(root_dir.join(UNITY_DIR))?;
+
+        for (index, members) in self.batches.iter().enumerate() {
+            let mut contents = String::from("// Generated by makegen --unity; do not edit.\n");
+            for &member in members {
+                contents.push_str("#include \"../");
+                contents.push_str(interner.resolve(member));
+                contents.push_str("\"\n");
+            }
 
-    Ok(())
+            // An identical TU is left untouched -- rewriting it would bump
+            // its mtime and recompile the batch on a no-op run.
+            let path = root_dir.join(Self::source_path(index, ext));
+            match std::fs::read(&path) {
+                Ok(existing) if existing == contents.as_bytes() => {}
+                _ => std::fs::write(path, contents)?,
+            }
+        }
+
+        Ok(())
+    }
+
+    fn source_path(index: usize, ext: &str) -> String {
+        format!("{}/unity_{}.{}", UNITY_DIR, index, ext)
+    }
+}
+
+fn is_batched(ctx: &GenerateContext, file: FileId) -> bool {
+    ctx.unity.map_or(false, |plan| plan.batch_of.contains_key(&file))
 }
 
-fn generate_file_variables(makefile: &mut File, ctx: &GenerateContext) -> std::io::Result<()> {
-    writeln!(makefile, "\nODIR := .OBJ\n")?;
+fn generate_compiler_variables(buffer: &mut String, ctx: &GenerateContext) {
+    buffer.push_str("CC := ");
+    buffer.push_str(ctx.cli.compiler);
+    buffer.push_str("\nCFLAGS := -Wall\nCFLAGS += -std=");
+    buffer.push_str(ctx.cli.standard);
+    buffer.push_str("\nCFLAGS += -");
+    buffer.push_str(ctx.cli.opt_level);
 
-    for file in ctx.dep_map.keys() {
-        generate_source_file_dependencies_variable_for_file(makefile, file, ctx)?;
+    // The compiler needs the same -I directories the scanner resolved
+    // includes against.
+    for dir in &ctx.cli.include_dirs {
+        buffer.push_str("\nCFLAGS += -I");
+        buffer.push_str(dir);
     }
 
-    writeln!(makefile)?;
+    buffer.push_str("\nLFLAGS :=");
+
+    // Sorted, since the scan discovers libraries in parallel and their
+    // arrival order would otherwise vary run to run.
+    let mut dlls: Vec<&String> = ctx.dlls.iter().collect();
+    dlls.sort_unstable();
+    for dll in dlls {
+        buffer.push_str(" -l");
+        buffer.push_str(dll);
+    }
 
-    Ok(())
+    buffer.push('\n');
+
+    if let Some(launcher) = ctx.cli.launcher {
+        buffer.push_str("LAUNCHER := ");
+        buffer.push_str(launcher);
+        buffer.push('\n');
+    }
+
+    // The .gch sits next to its header, which is where the compiler looks
+    // for a precompiled version before reading the header itself.
+    if let Some(header) = ctx.pch {
+        buffer.push_str("PCH_HEADER := ");
+        buffer.push_str(ctx.interner.resolve(header));
+        buffer.push_str("\nPCH := $(PCH_HEADER).gch\n");
+    }
+}
+
+fn generate_file_variables(buffer: &mut String, ctx: &GenerateContext) {
+    buffer.push_str("\nODIR := .OBJ\n\n");
+
+    // In pattern-rule mode the per-file prerequisites are attached to the
+    // object targets directly, and in auto-deps mode the compiler-emitted .d
+    // files carry them, so the _SOURCE_DEPS variables are not emitted.
+    let static_deps = !ctx.cli.pattern_rules && !ctx.cli.auto_deps;
+
+    if static_deps {
+        render_file_chunks(buffer, ctx, &ctx.records.sources, |buffer, file, ctx| {
+            if is_batched(ctx, file) {
+                return;
+            }
+            generate_source_file_dependencies_variable_for_file(buffer, file, ctx);
+        });
+    }
+
+    // Unity TU prerequisites are spelled out per batch unless the compiler
+    // maintains them through --auto-deps.
+    if !ctx.cli.auto_deps {
+        if let Some(plan) = ctx.unity {
+            generate_unity_source_deps_variables(buffer, plan, ctx);
+        }
+    }
+
+    if static_deps || (!ctx.cli.auto_deps && ctx.unity.is_some()) {
+        buffer.push('\n');
+    }
+}
+
+// One _SOURCE_DEPS-style variable per unity batch: the unity TU itself plus
+// the union of its members and everything they depend on.
+fn generate_unity_source_deps_variables(buffer: &mut String, plan: &UnityPlan, ctx: &GenerateContext) {
+    for (index, members) in plan.batches.iter().enumerate() {
+        buffer.push_str("UNITY_");
+        push_usize(buffer, index);
+        buffer.push_str("_SOURCE_DEPS := ");
+        buffer.push_str(&UnityPlan::source_path(index, ctx.cli.extension));
+
+        let mut seen = HashSet::new();
+        for &member in members {
+            for &dependency in &ctx.dep_map.get(&member).unwrap().0 {
+                // The closure carries sources from other batches for link
+                // discovery; this TU only reads its own members and the
+                // headers, so anything else must not recompile it.
+                let own_member = plan.batch_of.get(&dependency) == Some(&index);
+                if !own_member
+                    && has_extension(ctx.interner.resolve(dependency), ctx.cli.extension)
+                {
+                    continue;
+                }
+
+                if seen.insert(dependency) {
+                    buffer.push(' ');
+                    buffer.push_str(ctx.interner.resolve(dependency));
+                }
+            }
+        }
+
+        buffer.push('\n');
+    }
 }
 
 fn generate_object_file_dependencies_variable_for_file(
-    makefile: &mut File,
-    file: &str,
+    buffer: &mut String,
+    file: FileId,
     ctx: &GenerateContext,
-) -> std::io::Result<()> {
-    let var_name = strip_extension(file);
-    let var_name = object_file_dependencies_var_name(var_name);
-    write!(makefile, "{} := ", var_name)?;
+) {
+    buffer.push_str(ctx.records.var_stem(file));
+    buffer.push_str("_OBJECT_DEPS := ");
 
-    let dependencies = &ctx.dep_map.get(file).unwrap().0;
-    let object_dependencies = dependencies
-        .iter()
-        .filter(|d| has_extension(d, ctx.cli.extension))
-        .map(|d| format!("$(ODIR)/{}.o", escape_folder(strip_extension(d))))
-        .collect::<Vec<_>>()
-        .join(" ");
+    let dependencies = &ctx.dep_map.get(&file).unwrap().0;
+    let mut first = true;
+    let mut uses_archive = false;
+    let mut seen_batches = HashSet::new();
+    for &dependency in dependencies {
+        // Archived objects are linked through the common library instead of
+        // being repeated in every binary's object list.
+        if ctx.archived.contains(&dependency) {
+            uses_archive = true;
+            continue;
+        }
+
+        // Batched sources are represented by their unity object, once per
+        // batch no matter how many members the binary depends on.
+        if let Some(plan) = ctx.unity {
+            if let Some(&batch) = plan.batch_of.get(&dependency) {
+                if seen_batches.insert(batch) {
+                    if !first {
+                        buffer.push(' ');
+                    }
+                    first = false;
+
+                    buffer.push_str("$(ODIR)/unity_");
+                    push_usize(buffer, batch);
+                    buffer.push_str(".o");
+                }
+                continue;
+            }
+        }
+
+        // Headers have no record and no object of their own.
+        let object_stem = match ctx.records.try_object_stem(dependency) {
+            Some(stem) => stem,
+            None => continue,
+        };
+
+        if !first {
+            buffer.push(' ');
+        }
+        first = false;
+
+        buffer.push_str("$(ODIR)/");
+        buffer.push_str(object_stem);
+        buffer.push_str(".o");
+    }
+
+    // The archive goes last so the linker resolves the binary's own symbols
+    // before pulling members out of it.
+    if uses_archive {
+        if !first {
+            buffer.push(' ');
+        }
+        buffer.push_str("$(COMMON_LIB)");
+    }
 
-    writeln!(makefile, "{}", object_dependencies)?;
+    buffer.push('\n');
+}
+
+// Picks the header worth precompiling: the one reached by the most sources
+// in the flattened map (ties broken by path so the choice is stable). None
+// unless at least two sources include it -- a single consumer gains nothing.
+fn pch_header(dep_map: &DependencyMap, interner: &PathInterner, ext: &str) -> Option<FileId> {
+    let mut reference_counts: HashMap<FileId, u32> = HashMap::new();
+
+    for (&file, (dependencies, _)) in dep_map.iter() {
+        for &dependency in dependencies {
+            if dependency == file || has_extension(interner.resolve(dependency), ext) {
+                continue;
+            }
+
+            *reference_counts.entry(dependency).or_insert(0) += 1;
+        }
+    }
+
+    reference_counts
+        .into_iter()
+        .filter(|&(_, count)| count >= 2)
+        .max_by(|a, b| {
+            a.1.cmp(&b.1)
+                .then_with(|| interner.resolve(b.0).cmp(interner.resolve(a.0)))
+        })
+        .map(|(file, _)| file)
+}
+
+// The compiler as invoked by compile recipes: behind the launcher when one
+// was configured. Link recipes keep the bare $(CC); a launcher like ccache
+// only caches compilations.
+fn push_cc(buffer: &mut String, ctx: &GenerateContext) {
+    if ctx.cli.launcher.is_some() {
+        buffer.push_str("$(LAUNCHER) ");
+    }
+    buffer.push_str("$(CC)");
+}
+
+// Extra prerequisite making every object wait for the precompiled header.
+fn push_pch_prereq(buffer: &mut String, ctx: &GenerateContext) {
+    if ctx.pch.is_some() {
+        buffer.push_str(" $(PCH)");
+    }
+}
+
+// Sources (other than the binaries themselves) whose objects are linked into
+// two or more binaries: re-reading them per link is what --archive-shared
+// eliminates by bundling them into one static library.
+fn shared_objects(dep_map: &DependencyMap, interner: &PathInterner, ext: &str) -> HashSet<FileId> {
+    let mut reference_counts: HashMap<FileId, u32> = HashMap::new();
+
+    for (&file, (dependencies, has_main)) in dep_map.iter() {
+        if !*has_main {
+            continue;
+        }
+
+        for &dependency in dependencies {
+            if dependency == file
+                || !has_extension(interner.resolve(dependency), ext)
+                || dep_map.get(&dependency).map_or(false, |entry| entry.1)
+            {
+                continue;
+            }
+
+            *reference_counts.entry(dependency).or_insert(0) += 1;
+        }
+    }
 
-    Ok(())
+    reference_counts
+        .into_iter()
+        .filter(|&(_, count)| count >= 2)
+        .map(|(file, _)| file)
+        .collect()
 }
 
 fn generate_source_file_dependencies_variable_for_file(
-    makefile: &mut File,
-    file: &str,
+    buffer: &mut String,
+    file: FileId,
     ctx: &GenerateContext,
-) -> std::io::Result<()> {
-    let var_name = strip_extension(file);
-    let var_name = source_file_dependencies_var_name(&var_name);
-    write!(makefile, "{} := ", var_name)?;
+) {
+    buffer.push_str(ctx.records.var_stem(file));
+    buffer.push_str("_SOURCE_DEPS := ");
 
-    let dependencies = &ctx.dep_map.get(file).unwrap().0;
-    writeln!(makefile, "{}", dependencies.join(" "))?;
+    let mut first = true;
+    for &dependency in &ctx.dep_map.get(&file).unwrap().0 {
+        // The closure carries sibling sources for link discovery; compiling
+        // this object only reads the file itself and the headers, so other
+        // sources must not retrigger it.
+        if dependency != file
+            && has_extension(ctx.interner.resolve(dependency), ctx.cli.extension)
+        {
+            continue;
+        }
+
+        if !first {
+            buffer.push(' ');
+        }
+        first = false;
 
-    Ok(())
+        buffer.push_str(ctx.interner.resolve(dependency));
+    }
+
+    buffer.push('\n');
 }
 
-fn generate_targets(makefile: &mut File, ctx: &GenerateContext) -> std::io::Result<()> {
+// Emits one link rule: "<target>: $(<X>_OBJECT_DEPS) | $(ODIR)" followed by
+// the compiler invocation, with the LFLAGS suffix only on standalone
+// binaries. `name` overrides the file's own stem for the main binary, whose
+// target is the --binary name. $(ODIR) is order-only: dropping an object
+// into it bumps the directory mtime, which must not invalidate every other
+// target that lists it.
+fn generate_link_rule(
+    buffer: &mut String,
+    ctx: &GenerateContext,
+    target_prefix: &str,
+    file: FileId,
+    name: Option<&str>,
+    link_flags: bool,
+) {
+    buffer.push('\n');
+    buffer.push_str(target_prefix);
+    match name {
+        Some(name) => push_escaped(buffer, name),
+        None => buffer.push_str(ctx.records.escaped(file)),
+    }
+    buffer.push_str(": $(");
+    buffer.push_str(ctx.records.var_stem(file));
+    buffer.push_str("_OBJECT_DEPS) | $(ODIR)\n\t$(CC) $(CFLAGS) $(");
+    buffer.push_str(ctx.records.var_stem(file));
+    buffer.push_str("_OBJECT_DEPS) -o ");
+    buffer.push_str(name.unwrap_or_else(|| ctx.records.stem(file)));
+    if link_flags {
+        buffer.push_str(" $(LFLAGS)");
+    }
+    buffer.push_str("\n\n");
+}
+
+fn generate_targets(buffer: &mut String, ctx: &GenerateContext) {
     macro_rules! generate_target {
-        ($makefile:ident, $ctx:ident, $id:ident) => {
+        ($buffer:ident, $ctx:ident, $id:ident) => {
             if $ctx.partitioned.$id.len() > 0 {
-                std::write!($makefile, "{}: ", std::stringify!($id))?;
+                $buffer.push_str(std::stringify!($id));
+                $buffer.push_str(": ");
 
-                for file in &$ctx.partitioned.$id {
-                    std::write!($makefile, "{} ", self::escape_folder(file))?;
+                for &file in &$ctx.partitioned.$id {
+                    $buffer.push_str($ctx.records.escaped(file));
+                    $buffer.push(' ');
                 }
 
-                writeln!(makefile, "\n")?;
-
-                for file in &$ctx.partitioned.$id {
-                    generate_object_file_dependencies_variable_for_file(
-                        makefile,
-                        &format!("{}.{}", file, ctx.cli.extension),
-                        ctx,
-                    )?;
-
-                    std::writeln!(
-                        $makefile,
-                        "\n{target}: $(ODIR) $({dep_var})\n\
-                            \t$(CC) $(CFLAGS) $({dep_var}) -o {out}\n",
-                        target = self::escape_folder(file),
-                        dep_var = self::object_file_dependencies_var_name(file),
-                        out = file
-                    )?;
-                }
+                $buffer.push_str("\n\n");
+
+                self::render_file_chunks(
+                    $buffer,
+                    $ctx,
+                    &$ctx.partitioned.$id,
+                    |buffer, file, ctx| {
+                        generate_object_file_dependencies_variable_for_file(buffer, file, ctx);
+
+                        self::generate_link_rule(buffer, ctx, "", file, None, false);
+                    },
+                );
             }
         };
     }
 
-    writeln!(
-        makefile,
-        "all: binaries\n\n\
-        $(ODIR):\n\
-            \t@mkdir $(ODIR)\n",
-    )?;
+    buffer.push_str("all: binaries\n\n$(ODIR):\n\t@mkdir $(ODIR)\n\n");
+
+    generate_common_archive(buffer, ctx);
+    generate_pch_rule(buffer, ctx);
 
     // We should always have at least one standalone binary which is the main program
-    write!(makefile, "binaries: ")?;
+    buffer.push_str("binaries: ");
 
     let main_file = strip_extension(ctx.cli.main_file);
 
-    for bin_file in &ctx.partitioned.standalone {
-        let (prefix, name) = if *bin_file != main_file {
-            ("bin_", *bin_file)
+    for &bin_file in &ctx.partitioned.standalone {
+        let (prefix, name) = if ctx.records.stem(bin_file) != main_file {
+            ("bin_", None)
         } else {
-            ("", ctx.cli.binary)
+            ("", Some(ctx.cli.binary))
         };
 
-        write!(
-            makefile,
-            "{prefix}{name} ",
-            prefix = prefix,
-            name = escape_folder(name)
-        )?;
+        buffer.push_str(prefix);
+        match name {
+            Some(name) => push_escaped(buffer, name),
+            None => buffer.push_str(ctx.records.escaped(bin_file)),
+        }
+        buffer.push(' ');
     }
 
-    writeln!(makefile, "\n")?;
+    buffer.push_str("\n\n");
 
-    for bin_file in &ctx.partitioned.standalone {
-        generate_object_file_dependencies_variable_for_file(
-            makefile,
-            &format!("{}.{}", bin_file, ctx.cli.extension),
-            ctx,
-        )?;
+    render_file_chunks(
+        buffer,
+        ctx,
+        &ctx.partitioned.standalone,
+        |buffer, bin_file, ctx| {
+            generate_object_file_dependencies_variable_for_file(buffer, bin_file, ctx);
 
-        let (prefix, name) = if *bin_file != main_file {
-            ("bin_", *bin_file)
+            let (prefix, name) = if ctx.records.stem(bin_file) != main_file {
+                ("bin_", None)
+            } else {
+                ("", Some(ctx.cli.binary))
+            };
+
+            generate_link_rule(buffer, ctx, prefix, bin_file, name, true);
+        },
+    );
+
+    generate_target!(buffer, ctx, tests);
+    generate_target!(buffer, ctx, benchmarks);
+    generate_target!(buffer, ctx, examples);
+
+    if ctx.cli.pattern_rules {
+        generate_object_pattern_rules(buffer, ctx);
+    } else {
+        render_file_chunks(buffer, ctx, &ctx.records.sources, |buffer, id, ctx| {
+            if is_batched(ctx, id) {
+                return;
+            }
+
+            buffer.push_str("$(ODIR)/");
+            buffer.push_str(ctx.records.object_stem(id));
+            buffer.push_str(".o: ");
+            if ctx.cli.auto_deps {
+                // Only the source itself is listed; header prerequisites
+                // come from the -included .d file once it exists.
+                buffer.push_str(ctx.records.stem(id));
+                buffer.push('.');
+                buffer.push_str(ctx.cli.extension);
+            } else {
+                buffer.push_str("$(");
+                buffer.push_str(ctx.records.var_stem(id));
+                buffer.push_str("_SOURCE_DEPS)");
+            }
+            push_pch_prereq(buffer, ctx);
+            buffer.push_str(" | $(ODIR)\n\t");
+            push_cc(buffer, ctx);
+            buffer.push_str(" -c $(CFLAGS)");
+            push_dep_flags(buffer, ctx);
+            buffer.push(' ');
+            buffer.push_str(ctx.records.stem(id));
+            buffer.push('.');
+            buffer.push_str(ctx.cli.extension);
+            buffer.push_str(" -o $(ODIR)/");
+            buffer.push_str(ctx.records.object_stem(id));
+            buffer.push_str(".o\n\n");
+        });
+    }
+
+    if let Some(plan) = ctx.unity {
+        generate_unity_rules(buffer, plan, ctx);
+    }
+
+    generate_clean_target(buffer, ctx);
+
+    if ctx.cli.auto_deps {
+        generate_dep_includes(buffer, ctx);
+    }
+}
+
+// Archives the shared objects into one static library; the binaries' object
+// lists reference $(COMMON_LIB) instead, so the linker reads each shared
+// object once when the archive is built rather than once per binary. The
+// variables precede every _OBJECT_DEPS assignment, which expand them with :=.
+fn generate_common_archive(buffer: &mut String, ctx: &GenerateContext) {
+    if ctx.archived.is_empty() {
+        return;
+    }
+
+    buffer.push_str("AR := ar\nCOMMON_LIB := $(ODIR)/libcommon.a\nCOMMON_OBJS :=");
+
+    for &file in &ctx.records.sources {
+        if !ctx.archived.contains(&file) {
+            continue;
+        }
+        buffer.push_str(" $(ODIR)/");
+        buffer.push_str(ctx.records.object_stem(file));
+        buffer.push_str(".o");
+    }
+
+    buffer.push_str(
+        "\n\n$(COMMON_LIB): $(COMMON_OBJS) | $(ODIR)\n\t$(AR) rcs $@ $(COMMON_OBJS)\n\n",
+    );
+}
+
+// Precompiles the selected header once; every object rule lists $(PCH) as a
+// prerequisite so compiles start only after it exists.
+fn generate_pch_rule(buffer: &mut String, ctx: &GenerateContext) {
+    if ctx.pch.is_none() {
+        return;
+    }
+
+    buffer.push_str("$(PCH): $(PCH_HEADER)\n\t");
+    push_cc(buffer, ctx);
+    buffer.push_str(" $(CFLAGS) -x ");
+    buffer.push_str(if ctx.cli.extension == "cpp" {
+        "c++-header"
+    } else {
+        "c-header"
+    });
+    buffer.push_str(" $(PCH_HEADER) -o $(PCH)\n\n");
+}
+
+// Makes the compile recipes drop a .d file next to each object: -MMD writes
+// the make-syntax dependency list of user headers, -MP adds phony targets so
+// deleting a header does not break the build.
+fn push_dep_flags(buffer: &mut String, ctx: &GenerateContext) {
+    if ctx.cli.auto_deps {
+        buffer.push_str(" -MMD -MP");
+    }
+}
+
+// Pulls the compiler-written dependency files back in on the next run.
+// -include stays silent while they do not exist yet (first build), where the
+// source-only prerequisites above are sufficient anyway.
+fn generate_dep_includes(buffer: &mut String, ctx: &GenerateContext) {
+    buffer.push_str("\nDEPS :=");
+
+    for &id in &ctx.records.sources {
+        if is_batched(ctx, id) {
+            continue;
+        }
+
+        buffer.push_str(" $(ODIR)/");
+        buffer.push_str(ctx.records.object_stem(id));
+        buffer.push_str(".d");
+    }
+
+    if let Some(plan) = ctx.unity {
+        for index in 0..plan.batches.len() {
+            buffer.push_str(" $(ODIR)/unity_");
+            push_usize(buffer, index);
+            buffer.push_str(".d");
+        }
+    }
+
+    buffer.push_str("\n-include $(DEPS)\n");
+}
+
+// Explicit compile rules for the unity TUs; these never go through the
+// pattern rule since the generated sources live outside the source tree.
+fn generate_unity_rules(buffer: &mut String, plan: &UnityPlan, ctx: &GenerateContext) {
+    for index in 0..plan.batches.len() {
+        let source = UnityPlan::source_path(index, ctx.cli.extension);
+
+        buffer.push_str("$(ODIR)/unity_");
+        push_usize(buffer, index);
+        buffer.push_str(".o: ");
+        if ctx.cli.auto_deps {
+            buffer.push_str(&source);
         } else {
-            ("", ctx.cli.binary)
-        };
+            buffer.push_str("$(UNITY_");
+            push_usize(buffer, index);
+            buffer.push_str("_SOURCE_DEPS)");
+        }
+        push_pch_prereq(buffer, ctx);
+        buffer.push_str(" | $(ODIR)\n\t");
+        push_cc(buffer, ctx);
+        buffer.push_str(" -c $(CFLAGS)");
+        push_dep_flags(buffer, ctx);
+        buffer.push(' ');
+        buffer.push_str(&source);
+        buffer.push_str(" -o $(ODIR)/unity_");
+        push_usize(buffer, index);
+        buffer.push_str(".o\n\n");
+    }
+}
 
-        writeln!(
-            makefile,
-            "\n{prefix}{name}: $(ODIR) $({dep_var})\n\
-                    \t$(CC) $(CFLAGS) $({dep_var}) -o {out} $(LFLAGS)\n",
-            prefix = prefix,
-            name = escape_folder(name),
-            dep_var = object_file_dependencies_var_name(bin_file),
-            out = name
-        )?;
-    }
-
-    generate_target!(makefile, ctx, tests);
-    generate_target!(makefile, ctx, benchmarks);
-    generate_target!(makefile, ctx, examples);
-
-    for file in ctx
-        .dep_map
-        .keys()
-        .filter(|k| has_extension(k, ctx.cli.extension))
-        .map(|k| strip_extension(k))
-    {
-        writeln!(
-            makefile,
-            "$(ODIR)/{out}.o: $(ODIR) $({source_var})\n\
-                \t$(CC) -c $(CFLAGS) {file}.{extension} -o $(ODIR)/{out}.o\n",
-            file = file,
-            source_var = source_file_dependencies_var_name(file),
-            extension = ctx.cli.extension,
-            out = escape_folder(file),
-        )?;
+// One pattern rule carries the recipe for every object file; the per-file
+// lines below it are recipe-less, which make treats as extra prerequisites
+// for the matching target. This keeps the emitted Makefile proportional to
+// the dependency edges instead of repeating a rule body per source, which
+// also cuts make's own parse time on large trees.
+fn generate_object_pattern_rules(buffer: &mut String, ctx: &GenerateContext) {
+    buffer.push_str("$(ODIR)/%.o: %.");
+    buffer.push_str(ctx.cli.extension);
+    push_pch_prereq(buffer, ctx);
+    buffer.push_str("\n\t@mkdir -p $(@D)\n\t");
+    push_cc(buffer, ctx);
+    buffer.push_str(" -c $(CFLAGS)");
+    push_dep_flags(buffer, ctx);
+    buffer.push_str(" $< -o $@\n\n");
+
+    // The compiler-maintained .d files replace the statically scanned
+    // per-file prerequisite lines.
+    if ctx.cli.auto_deps {
+        return;
     }
 
-    generate_clean_target(makefile, ctx)?;
+    render_file_chunks(buffer, ctx, &ctx.records.sources, |buffer, file, ctx| {
+        if is_batched(ctx, file) {
+            return;
+        }
+
+        buffer.push_str("$(ODIR)/");
+        buffer.push_str(ctx.records.stem(file));
+        buffer.push_str(".o:");
+
+        // Sibling sources from the closure are link-time knowledge; the
+        // compile only depends on the headers (the source itself is the
+        // pattern rule's own prerequisite).
+        for dependency in ctx
+            .dep_map
+            .get(&file)
+            .unwrap()
+            .0
+            .iter()
+            .filter(|&&d| d != file)
+            .map(|&d| ctx.interner.resolve(d))
+            .filter(|d| !has_extension(d, ctx.cli.extension))
+        {
+            buffer.push(' ');
+            buffer.push_str(dependency);
+        }
+
+        buffer.push('\n');
+    });
 
-    Ok(())
+    buffer.push('\n');
 }
 
-fn generate_clean_target(makefile: &mut File, ctx: &GenerateContext) -> std::io::Result<()> {
-    write!(
-        makefile,
-        ".PHONY: clean\n\
-        clean:\n\
-            \trm -rf .OBJ ",
-    )?;
+fn generate_clean_target(buffer: &mut String, ctx: &GenerateContext) {
+    buffer.push_str(".PHONY: clean\nclean:\n\trm -rf .OBJ ");
 
     let main_file = strip_extension(ctx.cli.main_file);
 
-    let all_files = ctx
+    for &file in &ctx.partitioned.standalone {
+        let stem = ctx.records.stem(file);
+        buffer.push_str(if stem != main_file {
+            stem
+        } else {
+            ctx.cli.binary
+        });
+        buffer.push(' ');
+    }
+
+    for &file in ctx
         .partitioned
-        .standalone
+        .tests
         .iter()
-        .map(|f| if *f != main_file { f } else { &ctx.cli.binary })
-        .chain(ctx.partitioned.tests.iter())
         .chain(ctx.partitioned.benchmarks.iter())
-        .chain(ctx.partitioned.examples.iter());
-
-    for file in all_files {
-        write!(makefile, "{} ", file)?;
+        .chain(ctx.partitioned.examples.iter())
+    {
+        buffer.push_str(ctx.records.stem(file));
+        buffer.push(' ');
     }
 
-    writeln!(makefile)?;
+    if ctx.pch.is_some() {
+        buffer.push_str("$(PCH) ");
+    }
 
-    Ok(())
+    buffer.push('\n');
 }
 
-#[inline]
-fn escape_folder(filename: &str) -> String {
-    filename.replace('/', "_")
-}
+#[cfg(test)]
+mod tests {
+    use super::*;
 
-#[inline]
-fn file_dependencies_var_name(filename: &str, category: &str) -> String {
-    let var_name = escape_folder(filename);
-    format!("{}_{}_DEPS", var_name.to_ascii_uppercase(), category)
+    #[test]
+    fn flatten_computes_transitive_closures_with_cycles() {
+        let mut interner = PathInterner::new();
+        let main_c = interner.intern("main.c");
+        let a_h = interner.intern("a.h");
+        let b_h = interner.intern("b.h");
+        let a_c = interner.intern("a.c");
+
+        let mut dep_map = DependencyMap::new();
+        dep_map.insert(main_c, (vec![a_h], true));
+        // a.h and b.h include each other (guarded in the real sources), which
+        // forms a cycle the closure engine must not loop on.
+        dep_map.insert(a_h, (vec![b_h], false));
+        dep_map.insert(b_h, (vec![a_h], false));
+        // a.c is pulled in as the complementary source of a.h.
+        dep_map.insert(a_c, (vec![a_h], false));
+
+        let flat = flatten_dependencies(&dep_map, &interner, "c", &[]);
+
+        assert_eq!(flat[&main_c].0[0], main_c);
+        let main_deps: HashSet<_> = flat[&main_c].0.iter().copied().collect();
+        assert!(main_deps.contains(&a_h));
+        assert!(main_deps.contains(&b_h));
+        assert!(main_deps.contains(&a_c));
+        assert!(flat[&main_c].1);
+
+        assert_eq!(flat[&a_c].0[0], a_c);
+        let a_deps: HashSet<_> = flat[&a_c].0.iter().copied().collect();
+        assert!(a_deps.contains(&a_h));
+        assert!(a_deps.contains(&b_h));
+    }
+
+    #[test]
+    fn partition_classifies_mains_by_prefix() {
+        let mut interner = PathInterner::new();
+        let main_c = interner.intern("main.c");
+        let test_file = interner.intern("tests/test_util.c");
+        let bench_file = interner.intern("benchmarks/bench_util.c");
+        let helper = interner.intern("util.c");
+
+        let mut dep_map = DependencyMap::new();
+        dep_map.insert(main_c, (vec![], true));
+        dep_map.insert(test_file, (vec![], true));
+        dep_map.insert(bench_file, (vec![], true));
+        dep_map.insert(helper, (vec![], false));
+
+        let cli = Cli {
+            main_file: "main.c",
+            compiler: "gcc",
+            extension: "c",
+            binary: "prog",
+            standard: "c99",
+            opt_level: "O0",
+            tests: ["tests"].iter().copied().collect(),
+            benchmarks: ["benchmarks"].iter().copied().collect(),
+            examples: ["examples"].iter().copied().collect(),
+            watch: false,
+            timings: None,
+            preamble_scan: false,
+            pattern_rules: false,
+            auto_deps: false,
+            archive_shared: false,
+            unity: None,
+            launcher: None,
+            pch: false,
+            emit_graph: None,
+            roots: Vec::new(),
+            include_dirs: Vec::new(),
+            report_unchanged: false,
+        };
+
+        let partitioned = PartitionedFiles::partition(&cli, &dep_map, &interner);
+
+        assert_eq!(partitioned.standalone, vec![main_c]);
+        assert_eq!(partitioned.tests, vec![test_file]);
+        assert_eq!(partitioned.benchmarks, vec![bench_file]);
+        assert!(partitioned.examples.is_empty());
+    }
+
+    #[test]
+    fn records_precompute_names_in_path_order() {
+        let mut interner = PathInterner::new();
+        let util = interner.intern("sub/util.c");
+        let main_c = interner.intern("main.c");
+
+        let mut dep_map = DependencyMap::new();
+        dep_map.insert(main_c, (vec![main_c, util], true));
+        dep_map.insert(util, (vec![util], false));
+
+        let records = FileRecords::build(&dep_map, &interner, false);
+
+        assert_eq!(records.sources, vec![main_c, util]);
+        assert_eq!(records.stem(util), "sub/util");
+        assert_eq!(records.escaped(util), "sub_util");
+        assert_eq!(records.var_stem(util), "SUB_UTIL");
+        assert_eq!(records.object_stem(util), "sub_util");
+        assert!(records.try_object_stem(interner.intern("sub/util.h")).is_none());
+
+        // Pattern-rule mode keeps the directory layout in object names.
+        let records = FileRecords::build(&dep_map, &interner, true);
+        assert_eq!(records.object_stem(util), "sub/util");
+    }
 }
 
+// Appends a decimal index without going through format!.
 #[inline]
-fn source_file_dependencies_var_name(filename: &str) -> String {
-    file_dependencies_var_name(filename, "SOURCE")
+fn push_usize(buffer: &mut String, mut value: usize) {
+    let mut digits = [0u8; 20];
+    let mut at = digits.len();
+    loop {
+        at -= 1;
+        digits[at] = b'0' + (value % 10) as u8;
+        value /= 10;
+        if value == 0 {
+            break;
+        }
+    }
+    buffer.push_str(std::str::from_utf8(&digits[at..]).unwrap());
 }
 
+// Appends the filename with folder separators flattened to underscores,
+// without allocating an intermediate String.
 #[inline]
-fn object_file_dependencies_var_name(filename: &str) -> String {
-    file_dependencies_var_name(filename, "OBJECT")
+fn push_escaped(buffer: &mut String, filename: &str) {
+    for c in filename.chars() {
+        buffer.push(if c == '/' { '_' } else { c });
+    }
 }
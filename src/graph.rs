@@ -0,0 +1,203 @@
+use crate::{
+    intern::{FileId, PathInterner},
+    parser::DependencyMap,
+};
+use std::{collections::HashMap, convert::TryInto, fs, path::Path};
+
+pub const GRAPH_FILENAME: &str = ".makegen.graph";
+
+const GRAPH_MAGIC: &[u8; 4] = b"MGGR";
+const GRAPH_VERSION: u32 = 1;
+
+// Bytes per node record and header field count, see the layout below.
+const NODE_RECORD_WORDS: usize = 5;
+const HEADER_WORDS: usize = 4;
+
+const FLAG_HAS_MAIN: u32 = 1;
+
+// Serialized dependency graph with an offset-based layout, so consumers can
+// memory-map the file and traverse it in place without deserialization. All
+// integers are little-endian u32 and every section is 4-byte aligned:
+//
+//   magic "MGGR"
+//   version, node_count, edge_count, strings_len   (header words)
+//   node records: path_offset, path_len, flags, edges_start, edges_len
+//   edge array:   edge_count node indices
+//   string arena: concatenated path bytes
+//
+// Nodes are sorted by path, so the same tree always serializes to the same
+// bytes and consumers can binary-search paths without an index.
+pub fn write_graph(
+    path: &Path,
+    dep_map: &DependencyMap,
+    interner: &PathInterner,
+) -> std::io::Result<()> {
+    let mut ids: Vec<FileId> = dep_map
+        .iter()
+        .flat_map(|(&file, (dependencies, _))| {
+            std::iter::once(file).chain(dependencies.iter().copied())
+        })
+        .collect();
+    ids.sort_by_key(|&id| interner.resolve(id));
+    ids.dedup();
+
+    let index_of: HashMap<FileId, u32> = ids
+        .iter()
+        .enumerate()
+        .map(|(index, &id)| (id, index as u32))
+        .collect();
+
+    let mut records = Vec::with_capacity(ids.len() * NODE_RECORD_WORDS);
+    let mut edges: Vec<u32> = Vec::new();
+    let mut strings = String::new();
+
+    for &id in &ids {
+        let path = interner.resolve(id);
+        let (has_main, node_edges) = match dep_map.get(&id) {
+            Some((dependencies, has_main)) => (*has_main, &dependencies[..]),
+            // Headers appear only as edge targets; they carry no edges of
+            // their own in the flattened map.
+            None => (false, &[][..]),
+        };
+
+        records.push(strings.len() as u32);
+        records.push(path.len() as u32);
+        records.push(if has_main { FLAG_HAS_MAIN } else { 0 });
+        records.push(edges.len() as u32);
+        records.push(node_edges.len() as u32);
+
+        strings.push_str(path);
+        edges.extend(node_edges.iter().map(|d| index_of[d]));
+    }
+
+    let mut buffer = Vec::with_capacity(
+        GRAPH_MAGIC.len() + (HEADER_WORDS + records.len() + edges.len()) * 4 + strings.len(),
+    );
+    buffer.extend_from_slice(GRAPH_MAGIC);
+    for word in [
+        GRAPH_VERSION,
+        ids.len() as u32,
+        edges.len() as u32,
+        strings.len() as u32,
+    ]
+    .iter()
+    .chain(records.iter())
+    .chain(edges.iter())
+    {
+        buffer.extend_from_slice(&word.to_le_bytes());
+    }
+    buffer.extend_from_slice(strings.as_bytes());
+
+    // The layout is deterministic, so an unchanged graph is left untouched;
+    // rewriting identical bytes would bump the mtime and retrigger the
+    // downstream tooling the file exists for.
+    match fs::read(path) {
+        Ok(existing) if existing == buffer => Ok(()),
+        _ => fs::write(path, buffer),
+    }
+}
+
+// Zero-copy view over a serialized graph, typically backed by a memory map.
+// Accessors read straight out of the underlying bytes.
+pub struct GraphView<'b> {
+    nodes: &'b [u8],
+    edges: &'b [u8],
+    strings: &'b [u8],
+    node_count: usize,
+}
+
+impl<'b> GraphView<'b> {
+    pub fn parse(bytes: &'b [u8]) -> Option<Self> {
+        let (magic, rest) = bytes.split_at_checked(GRAPH_MAGIC.len())?;
+        if magic != GRAPH_MAGIC || read_u32(rest, 0)? != GRAPH_VERSION {
+            return None;
+        }
+
+        let node_count = read_u32(rest, 1)? as usize;
+        let edge_count = read_u32(rest, 2)? as usize;
+        let strings_len = read_u32(rest, 3)? as usize;
+
+        let rest = &rest[HEADER_WORDS * 4..];
+        let (nodes, rest) = rest.split_at_checked(node_count * NODE_RECORD_WORDS * 4)?;
+        let (edges, rest) = rest.split_at_checked(edge_count * 4)?;
+        let strings = rest.get(..strings_len)?;
+
+        Some(Self {
+            nodes,
+            edges,
+            strings,
+            node_count,
+        })
+    }
+
+    pub fn node_count(&self) -> usize {
+        self.node_count
+    }
+
+    pub fn path(&self, node: usize) -> &'b str {
+        let offset = self.node_word(node, 0) as usize;
+        let len = self.node_word(node, 1) as usize;
+        std::str::from_utf8(&self.strings[offset..offset + len]).unwrap()
+    }
+
+    pub fn has_main(&self, node: usize) -> bool {
+        self.node_word(node, 2) & FLAG_HAS_MAIN != 0
+    }
+
+    pub fn edges(&self, node: usize) -> impl Iterator<Item = usize> + 'b {
+        let start = self.node_word(node, 3) as usize;
+        let len = self.node_word(node, 4) as usize;
+        let edges = self.edges;
+        (start..start + len).map(move |e| read_u32(edges, e).unwrap() as usize)
+    }
+
+    fn node_word(&self, node: usize, word: usize) -> u32 {
+        read_u32(self.nodes, node * NODE_RECORD_WORDS + word).unwrap()
+    }
+}
+
+fn read_u32(bytes: &[u8], word_index: usize) -> Option<u32> {
+    let at = word_index * 4;
+    Some(u32::from_le_bytes(
+        bytes.get(at..at + 4)?.try_into().ok()?,
+    ))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn graph_round_trips_through_the_binary_layout() {
+        let mut interner = PathInterner::new();
+        let main_c = interner.intern("main.c");
+        let util_c = interner.intern("util.c");
+        let util_h = interner.intern("util.h");
+
+        let mut dep_map = DependencyMap::new();
+        dep_map.insert(main_c, (vec![main_c, util_h, util_c], true));
+        dep_map.insert(util_c, (vec![util_c, util_h], false));
+
+        let path = std::env::temp_dir().join("makegen_graph_test.graph");
+        write_graph(&path, &dep_map, &interner).unwrap();
+
+        let bytes = fs::read(&path).unwrap();
+        let view = GraphView::parse(&bytes).unwrap();
+
+        // Nodes come out sorted by path.
+        assert_eq!(view.node_count(), 3);
+        assert_eq!(view.path(0), "main.c");
+        assert_eq!(view.path(1), "util.c");
+        assert_eq!(view.path(2), "util.h");
+
+        assert!(view.has_main(0));
+        assert!(!view.has_main(1));
+
+        assert_eq!(view.edges(0).collect::<Vec<_>>(), vec![0, 2, 1]);
+        assert_eq!(view.edges(1).collect::<Vec<_>>(), vec![1, 2]);
+        // util.h is an edge target only.
+        assert_eq!(view.edges(2).count(), 0);
+
+        fs::remove_file(&path).unwrap();
+    }
+}
@@ -0,0 +1,93 @@
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+
+// Identifies an interned path. Graph edges and dependency-map keys are plain
+// FileIds, so comparisons and hashing are integer operations and the path
+// bytes themselves exist exactly once.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct FileId(u32);
+
+impl FileId {
+    #[inline]
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+// All interned path bytes live contiguously in one arena; each FileId maps to
+// a (start, len) span inside it. Lookup goes through a hash index keyed by
+// the path hash, with the (rare) collisions resolved against the arena, so no
+// duplicate copy of any path is kept for the reverse mapping.
+#[derive(Debug, Default)]
+pub struct PathInterner {
+    arena: String,
+    spans: Vec<(u32, u32)>,
+    index: HashMap<u64, Vec<FileId>>,
+}
+
+impl PathInterner {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn intern(&mut self, path: &str) -> FileId {
+        if let Some(id) = self.get(path) {
+            return id;
+        }
+
+        let start = self.arena.len() as u32;
+        self.arena.push_str(path);
+        let id = FileId(self.spans.len() as u32);
+        self.spans.push((start, path.len() as u32));
+        self.index.entry(Self::hash_path(path)).or_default().push(id);
+
+        id
+    }
+
+    pub fn get(&self, path: &str) -> Option<FileId> {
+        self.index
+            .get(&Self::hash_path(path))?
+            .iter()
+            .copied()
+            .find(|&id| self.resolve(id) == path)
+    }
+
+    #[inline]
+    pub fn resolve(&self, id: FileId) -> &str {
+        let (start, len) = self.spans[id.index()];
+        &self.arena[start as usize..(start + len) as usize]
+    }
+
+    pub fn iter_ids(&self) -> impl Iterator<Item = FileId> {
+        (0..self.spans.len() as u32).map(FileId)
+    }
+
+    fn hash_path(path: &str) -> u64 {
+        let mut hasher = DefaultHasher::new();
+        path.hash(&mut hasher);
+        hasher.finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn interning_deduplicates_paths() {
+        let mut interner = PathInterner::new();
+
+        let main = interner.intern("main.c");
+        let util = interner.intern("sub/util.h");
+        let main_again = interner.intern("main.c");
+
+        assert_eq!(main, main_again);
+        assert_ne!(main, util);
+        assert_eq!(interner.iter_ids().count(), 2);
+        assert_eq!(interner.resolve(main), "main.c");
+        assert_eq!(interner.resolve(util), "sub/util.h");
+        assert_eq!(interner.get("sub/util.h"), Some(util));
+        assert_eq!(interner.get("missing.h"), None);
+    }
+}
@@ -0,0 +1,12 @@
+#[macro_use]
+extern crate lazy_static;
+
+pub mod cache;
+pub mod cli;
+pub mod filename_utils;
+pub mod generate;
+pub mod graph;
+pub mod intern;
+pub mod parser;
+pub mod timings;
+pub mod watch;
@@ -1,16 +1,7 @@
-#[macro_use]
-extern crate lazy_static;
-
-mod cli;
-mod filename_utils;
-mod generate;
-mod parser;
-
 use clap::{App, Arg};
-use cli::Cli;
-use generate::*;
-use parser::Parser;
-use std::error::Error;
+use makegen::{cli::Cli, generate::*, parser::Parser, timings, watch};
+use rayon::prelude::*;
+use std::{error::Error, path::PathBuf};
 
 fn main() -> Result<(), Box<dyn Error>> {
     let matches = App::new("makegen")
@@ -102,6 +93,105 @@ fn main() -> Result<(), Box<dyn Error>> {
                 .multiple(true)
                 .min_values(1)
         )
+        .arg(
+            Arg::with_name("timings")
+                .long("timings")
+                .value_name("FORMAT")
+                .help("Report pipeline phase timings and counters after the run (text or json)")
+                .takes_value(true)
+                .possible_values(&["text", "json"])
+                .min_values(0)
+                .max_values(1),
+        )
+        .arg(
+            Arg::with_name("archive_shared")
+                .long("archive-shared")
+                .help("Archive objects shared by two or more binaries into a common static library and link the binaries against it, so the linker reads each shared object once instead of once per binary")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("auto_deps")
+                .long("auto-deps")
+                .help("Let the compiler maintain header dependencies: compile rules pass -MMD -MP, drop .d files next to the objects and the Makefile -includes them, so the Makefile stays correct when #includes change without re-running makegen")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("include_dirs")
+                .short("I")
+                .long("include-dir")
+                .value_name("DIRECTORY")
+                .help("Add a directory (relative to the root) to the include search path. Quoted includes that do not resolve next to the including file are looked up in these, in order, like the compiler's -I")
+                .takes_value(true)
+                .multiple(true)
+                .number_of_values(1),
+        )
+        .arg(
+            Arg::with_name("emit_graph")
+                .long("emit-graph")
+                .value_name("PATH")
+                .help("Also serialize the flattened dependency graph to a compact binary file (default .makegen.graph) that downstream tooling can memory-map and traverse without parsing the Makefile")
+                .takes_value(true)
+                .min_values(0)
+                .max_values(1),
+        )
+        .arg(
+            Arg::with_name("launcher")
+                .long("launcher")
+                .value_name("COMMAND")
+                .help("Prefix every compile invocation with a compiler launcher such as ccache, emitted as a LAUNCHER variable so it can still be overridden on the make command line")
+                .takes_value(true)
+                .min_values(1)
+                .max_values(1),
+        )
+        .arg(
+            Arg::with_name("pch")
+                .long("pch")
+                .help("Precompile the most widely included header: a .gch is built next to it before any object compiles, and the compiler picks it up wherever that header is included")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("pattern_rules")
+                .long("pattern-rules")
+                .help("Emit a single pattern rule for object files plus per-file prerequisite lines instead of an explicit rule per source, which keeps the generated Makefile small on large trees")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("report_unchanged")
+                .long("report-unchanged")
+                .help("Exit with status 3 when every generated Makefile was already up to date. The write itself is always skipped when the content is identical, so an unchanged Makefile keeps its mtime either way")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("preamble_scan")
+                .long("preamble-scan")
+                .help("Only scan the directive preamble of each file for includes instead of the whole contents (main detection stays bounded to the head and tail of the file)")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("unity")
+                .long("unity")
+                .value_name("N")
+                .help("Compile non-main sources as unity (jumbo) translation units of N sources each. makegen writes the unity sources under .makegen_unity and the generated rules compile those, so shared headers are parsed once per batch instead of once per file")
+                .takes_value(true)
+                .min_values(1)
+                .max_values(1),
+        )
+        .arg(
+            Arg::with_name("watch")
+                .short("w")
+                .long("watch")
+                .help("Stay resident and regenerate the Makefile whenever a source or header file changes")
+                .takes_value(false),
+        )
+        .arg(
+            Arg::with_name("roots")
+                .long("roots")
+                .value_name("DIRECTORY*")
+                .help("Batch mode: generate a Makefile for each given root directory in one process, scanning and generating the roots in parallel instead of launching makegen once per subproject")
+                .takes_value(true)
+                .multiple(true)
+                .min_values(1),
+        )
         .arg(
             Arg::with_name("main_file")
                 .long("main-file")
@@ -117,8 +207,63 @@ fn main() -> Result<(), Box<dyn Error>> {
 
     let cli = Cli::from_matches(&matches)?;
     let root_dir = std::env::current_dir()?;
-    let parser = Parser::new(root_dir, &cli);
+
+    if cli.timings.is_some() {
+        timings::enable();
+    }
+
+    if !cli.roots.is_empty() {
+        if cli.watch {
+            return Err("--watch cannot be combined with --roots".into());
+        }
+
+        // Each root is an independent parse + generation; the batch shares
+        // one process, one thread pool and one warm binary across all of
+        // them. Errors carry the offending root, since sixty of them may be
+        // in flight at once.
+        let written: Vec<bool> = cli
+            .roots
+            .par_iter()
+            .map(|root| -> Result<bool, String> {
+                // Roots may be given relative to the invocation directory;
+                // the parser needs them absolute to root-relativize includes.
+                let root_dir = PathBuf::from(root)
+                    .canonicalize()
+                    .map_err(|e| format!("{}: {}", root, e))?;
+                let parser = Parser::new(root_dir.clone(), &cli);
+                let result = parser.parse().map_err(|e| format!("{}: {}", root, e))?;
+                generate_makefile(&cli, &result, &root_dir)
+                    .map_err(|e| format!("{}: {}", root, e))
+            })
+            .collect::<Result<_, String>>()
+            .map_err(|e| -> Box<dyn Error> { e.into() })?;
+
+        if let Some(format) = cli.timings {
+            timings::report(format);
+        }
+
+        if cli.report_unchanged && written.iter().all(|&written| !written) {
+            std::process::exit(3);
+        }
+
+        return Ok(());
+    }
+
+    if cli.watch {
+        return watch::watch(root_dir, &cli);
+    }
+
+    let parser = Parser::new(root_dir.clone(), &cli);
     let result = parser.parse()?;
-    generate_makefile(&cli, result)?;
+    let written = generate_makefile(&cli, &result, &root_dir)?;
+
+    if let Some(format) = cli.timings {
+        timings::report(format);
+    }
+
+    if cli.report_unchanged && !written {
+        std::process::exit(3);
+    }
+
     Ok(())
 }
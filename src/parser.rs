@@ -1,19 +1,51 @@
-use crate::{cli::Cli, filename_utils::*};
+use crate::{
+    cache::{CacheEntry, ParseCache},
+    cli::Cli,
+    filename_utils::*,
+    intern::{FileId, PathInterner},
+    timings,
+};
+use memchr::{memchr, memchr_iter, memmem, memrchr};
+use memmap2::Mmap;
+use rayon::prelude::*;
 use std::{
     collections::{HashMap, HashSet},
     error::Error,
     fs,
-    path::{Path, PathBuf},
+    path::{Component, Path, PathBuf},
 };
-use walkdir::{DirEntry, WalkDir};
+use ignore::WalkBuilder;
+
+// Ignore patterns specific to makegen, honored in addition to .gitignore.
+const MAKEGEN_IGNORE_FILENAME: &str = ".makegenignore";
+
+// Errors crossing the worker threads must be Send + Sync; at the public interface
+// they degrade to the plain Box<dyn Error> the rest of the crate uses.
+type ScanError = Box<dyn Error + Send + Sync>;
+
+// Physical identity of a file, used to collapse the multiple names a
+// symlinked or hard-linked source can be reached under during the walk.
+#[cfg(unix)]
+fn file_identity(metadata: &fs::Metadata) -> Option<(u64, u64)> {
+    use std::os::unix::fs::MetadataExt;
+    Some((metadata.dev(), metadata.ino()))
+}
 
-// The bool indicates whether the key (source file) has a main function in it or not
-pub type DependencyMap = HashMap<String, (Vec<String>, bool)>;
+#[cfg(not(unix))]
+fn file_identity(_metadata: &fs::Metadata) -> Option<(u64, u64)> {
+    None
+}
+
+// The bool indicates whether the key (source file) has a main function in it
+// or not. Keys and edges are interned FileIds; the path bytes live once in
+// the ParseResult's interner.
+pub type DependencyMap = HashMap<FileId, (Vec<FileId>, bool)>;
 
 #[derive(Debug)]
 pub struct ParseResult {
     pub dependency_map: DependencyMap,
     pub dlls: Vec<String>,
+    pub interner: PathInterner,
 }
 
 pub struct Parser<'cli> {
@@ -21,40 +53,202 @@ pub struct Parser<'cli> {
     cli: &'cli Cli<'cli>,
 }
 
-struct ParseContext<'c> {
-    dependency_map: &'c mut DependencyMap,
-    dlls: &'c mut Vec<String>,
-    seen: HashSet<String>,
+// Each scanning worker accumulates into its own context so no locks are taken
+// on the hot path; the partial contexts are merged once scanning is done.
+// Everything the scanning workers share read-only for the duration of a
+// parse.
+struct ScanEnvironment<'s> {
+    root_dir: &'s PathBuf,
+    cache: &'s ParseCache,
+    dll_db: &'s DllDatabase,
+    // -I search directories, relative to the root, probed in order after the
+    // including file's own directory.
+    include_dirs: &'s [&'s str],
+    preamble_scan: bool,
+}
+
+// Two-level include resolution cache. `resolved` maps (directory of the
+// including file, include text) to the final root-relative path, so a header
+// included by thousands of files costs one resolution instead of one
+// canonicalize syscall chain per occurrence. `probes` remembers the positive
+// or negative outcome of statting one (directory, include name) pair, so the
+// -I search path does at most one filesystem probe per unique pair no matter
+// how many includers walk it.
+#[derive(Debug, Default)]
+struct ResolutionCache {
+    resolved: HashMap<(PathBuf, String), String>,
+    probes: HashMap<(PathBuf, String), Option<String>>,
+}
+
+impl ResolutionCache {
+    fn merge(&mut self, other: Self) {
+        self.resolved.extend(other.resolved);
+        self.probes.extend(other.probes);
+    }
+}
+
+struct ParseContext {
+    dependency_map: DependencyMap,
+    dlls: Vec<String>,
+    dll_set: HashSet<String>,
+    seen: HashSet<FileId>,
+    interner: PathInterner,
+    cache_updates: ParseCache,
+    resolution_cache: ResolutionCache,
 }
 
-// These are some default mappings for dynamic linked libraries
 lazy_static! {
-    static ref DLL_MAP: HashMap<&'static str, &'static str> = {
-        let mut dll_map = HashMap::new();
-        dll_map.insert("math.h", "m");
-        dll_map.insert("pthread.h", "pthread");
-        dll_map.insert("ncurses.h", "ncurses");
-        dll_map
-    };
+    // Precompiled vectorized searcher for the main() detection sweep.
+    static ref MAIN_FINDER: memmem::Finder<'static> = memmem::Finder::new("main(");
+}
+
+// Default mappings from system headers to linkage names. The table is a
+// compile-time perfect hash, so a lookup is one hash and one probe with no
+// runtime initialization.
+static DLL_MAP: phf::Map<&'static str, &'static str> = phf::phf_map! {
+    "math.h" => "m",
+    "pthread.h" => "pthread",
+    "semaphore.h" => "pthread",
+    "ncurses.h" => "ncurses",
+    "curses.h" => "ncurses",
+    "dlfcn.h" => "dl",
+    "mqueue.h" => "rt",
+    "aio.h" => "rt",
+    "zlib.h" => "z",
+    "openssl/ssl.h" => "ssl",
+    "openssl/crypto.h" => "crypto",
+    "openssl/evp.h" => "crypto",
+    "curl/curl.h" => "curl",
+    "X11/Xlib.h" => "X11",
+    "GL/gl.h" => "GL",
+    "GL/glu.h" => "GLU",
+    "GL/glut.h" => "glut",
+    "alsa/asoundlib.h" => "asound",
+    "png.h" => "png",
+    "jpeglib.h" => "jpeg",
+    "sqlite3.h" => "sqlite3",
+    "pcap.h" => "pcap",
+    "readline/readline.h" => "readline",
+    "uuid/uuid.h" => "uuid",
+    "crypt.h" => "crypt",
+};
+
+// Project-local header-to-library overrides, one `header = lib` per line.
+const MAKEGEN_LIBS_FILENAME: &str = ".makegenlibs";
+
+// The built-in table plus any user mappings loaded from the root; user
+// entries win over the defaults so a project can redirect or add headers.
+#[derive(Debug, Default)]
+pub struct DllDatabase {
+    user: HashMap<String, String>,
+}
+
+impl DllDatabase {
+    pub fn load(root_dir: &Path) -> Self {
+        match fs::read_to_string(root_dir.join(MAKEGEN_LIBS_FILENAME)) {
+            Ok(contents) => Self::from_contents(&contents),
+            Err(_) => Self::default(),
+        }
+    }
+
+    fn from_contents(contents: &str) -> Self {
+        let mut user = HashMap::new();
+        for line in contents.lines() {
+            let line = line.trim();
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+
+            if let Some(separator) = line.find('=') {
+                let header = line[..separator].trim();
+                let library = line[separator + 1..].trim();
+                if !header.is_empty() && !library.is_empty() {
+                    user.insert(header.to_string(), library.to_string());
+                }
+            }
+        }
+
+        Self { user }
+    }
+
+    pub fn lookup(&self, header: &str) -> Option<&str> {
+        self.user
+            .get(header)
+            .map(String::as_str)
+            .or_else(|| DLL_MAP.get(header).copied())
+    }
+
+    // Identity of the overrides file, folded into the parse-cache header:
+    // cached entries hold already-resolved linkage names, so any edit to
+    // .makegenlibs must discard them.
+    pub fn stamp(root_dir: &Path) -> String {
+        match fs::metadata(root_dir.join(MAKEGEN_LIBS_FILENAME)) {
+            Ok(metadata) => {
+                let (secs, nanos, size) = CacheEntry::stamp_of(&metadata);
+                format!("{}.{}.{}", secs, nanos, size)
+            }
+            Err(_) => "none".to_string(),
+        }
+    }
 }
 
 impl ParseResult {
-    pub fn new(dependency_map: DependencyMap, dlls: Vec<String>) -> Self {
+    pub fn new(dependency_map: DependencyMap, dlls: Vec<String>, interner: PathInterner) -> Self {
         Self {
             dependency_map,
             dlls,
+            interner,
         }
     }
 }
 
-impl<'c> ParseContext<'c> {
-    pub fn new(dependency_map: &'c mut DependencyMap, dlls: &'c mut Vec<String>) -> Self {
+impl ParseContext {
+    pub fn new() -> Self {
         Self {
-            dependency_map,
-            dlls,
+            dependency_map: DependencyMap::new(),
+            dlls: Vec::new(),
+            dll_set: HashSet::new(),
             seen: HashSet::new(),
+            interner: PathInterner::new(),
+            cache_updates: ParseCache::default(),
+            resolution_cache: ResolutionCache::default(),
+        }
+    }
+
+    // Deduplicates through a set instead of a linear scan of the list.
+    fn push_dll(&mut self, dll: &str) {
+        if !self.dll_set.contains(dll) {
+            self.dll_set.insert(dll.to_string());
+            self.dlls.push(dll.to_string());
         }
     }
+
+    // Workers intern into their own arenas, so merging remaps the other
+    // context's FileIds through a translation table before taking its entries.
+    pub fn merge(mut self, other: Self) -> Self {
+        let remap: Vec<FileId> = other
+            .interner
+            .iter_ids()
+            .map(|id| self.interner.intern(other.interner.resolve(id)))
+            .collect();
+
+        for (file, (dependencies, has_main)) in other.dependency_map {
+            let file = remap[file.index()];
+            let dependencies = dependencies.iter().map(|d| remap[d.index()]).collect();
+            self.dependency_map
+                .entry(file)
+                .or_insert((dependencies, has_main));
+        }
+
+        for dll in other.dlls {
+            self.push_dll(&dll);
+        }
+
+        self.seen.extend(other.seen.iter().map(|id| remap[id.index()]));
+        self.cache_updates.merge(other.cache_updates);
+        self.resolution_cache.merge(other.resolution_cache);
+        self
+    }
 }
 
 impl<'cli> Parser<'cli> {
@@ -63,29 +257,175 @@ impl<'cli> Parser<'cli> {
     }
 
     pub fn parse(&self) -> Result<ParseResult, Box<dyn Error>> {
-        let mut dependency_map = HashMap::new();
-        let mut dlls = Vec::new();
+        // The walk prunes ignored subtrees before descent: hidden entries,
+        // .gitignore'd directories (vendored trees, build output) and
+        // anything matched by a .makegenignore file never get stat'ed.
+        // Symlinks are followed (the walker breaks traversal loops), and
+        // files reachable under several link or hard-link names are kept
+        // once, under the first name seen, so each physical file becomes
+        // exactly one graph node and one object rule. The surviving source
+        // files are collected up front and scanned on rayon's work-stealing
+        // pool.
+        let source_files = timings::time_phase("walk", || {
+            let walker = WalkBuilder::new(&self.root_dir)
+                .follow_links(true)
+                .require_git(false)
+                .add_custom_ignore_filename(MAKEGEN_IGNORE_FILENAME)
+                .build();
+
+            let mut seen_identities = HashSet::new();
+            walker
+                .filter_map(|r| r.ok())
+                .filter(|e| {
+                    e.file_type().map_or(false, |t| t.is_file())
+                        && has_extension(e.path(), self.cli.extension)
+                })
+                .filter(|e| {
+                    match e.metadata().ok().as_ref().and_then(file_identity) {
+                        Some(identity) => seen_identities.insert(identity),
+                        // No identity available: keep the entry rather than
+                        // silently dropping a source.
+                        None => true,
+                    }
+                })
+                .map(|e| {
+                    e.path()
+                        .strip_prefix(&self.root_dir)
+                        .map(Path::to_path_buf)
+                })
+                .collect::<Result<Vec<_>, _>>()
+        })?;
+
+        let libs_stamp = DllDatabase::stamp(&self.root_dir);
+        let cache = ParseCache::load(
+            &self.root_dir,
+            self.scan_mode(),
+            &self.cli.include_dirs,
+            &libs_stamp,
+        );
+        let dll_db = DllDatabase::load(&self.root_dir);
+        let env = ScanEnvironment {
+            root_dir: &self.root_dir,
+            cache: &cache,
+            dll_db: &dll_db,
+            include_dirs: &self.cli.include_dirs,
+            preamble_scan: self.cli.preamble_scan,
+        };
+
+        let ctx = timings::time_phase("scan", || {
+            source_files
+                .par_iter()
+                .try_fold(ParseContext::new, |mut ctx, filename| {
+                    read_file_and_get_include_files(&env, filename, &mut ctx)?;
+                    Ok(ctx)
+                })
+                .try_reduce(ParseContext::new, |lhs, rhs| Ok(lhs.merge(rhs)))
+        })
+        .map_err(|e: ScanError| -> Box<dyn Error> { e })?;
+
+        // Only files reachable in this run are written back, so entries for
+        // deleted files age out naturally. The cache is best-effort: failing
+        // to persist it must not fail the generation.
+        let _ = ctx.cache_updates.store(
+            &self.root_dir,
+            self.scan_mode(),
+            &self.cli.include_dirs,
+            &libs_stamp,
+        );
 
-        let filter_criteria = |r: &Result<DirEntry, _>| {
-            r.as_ref()
-                .map(|e| e.file_type().is_file() && has_extension(e.path(), self.cli.extension))
-                .unwrap_or(false)
+        Ok(ParseResult::new(ctx.dependency_map, ctx.dlls, ctx.interner))
+    }
+
+    // Re-scans a single file (given relative to the root) and patches the
+    // previous parse result in place, so watch mode pays for one file scan
+    // per save instead of a full walk and parse.
+    pub fn reparse_file(
+        &self,
+        filename: &Path,
+        result: &mut ParseResult,
+    ) -> Result<(), Box<dyn Error>> {
+        self.remove_file(filename, result);
+
+        let cache = ParseCache::default();
+        let dll_db = DllDatabase::load(&self.root_dir);
+        let env = ScanEnvironment {
+            root_dir: &self.root_dir,
+            cache: &cache,
+            dll_db: &dll_db,
+            include_dirs: &self.cli.include_dirs,
+            preamble_scan: self.cli.preamble_scan,
         };
 
-        let walker = WalkDir::new(&self.root_dir).into_iter();
-        for entry in walker
-            .filter_entry(|e| !is_hidden(e))
-            .filter(|r| filter_criteria(r))
-        {
-            if let Ok(entry) = entry {
-                let mut ctx = ParseContext::new(&mut dependency_map, &mut dlls);
-                let filename = entry.path().strip_prefix(&self.root_dir)?;
-                read_file_and_get_include_files_recursively(&self.root_dir, filename, &mut ctx)?;
+        let mut ctx = ParseContext::new();
+        read_file_and_get_include_files(&env, filename, &mut ctx)
+            .map_err(|e: ScanError| -> Box<dyn Error> { e })?;
+
+        // Headers reached from the changed file were scanned fresh, so their
+        // entries overwrite whatever the previous parse recorded for them.
+        // The scan interned into its own arena; remap into the result's.
+        let scan_interner = ctx.interner;
+        for (file, (dependencies, has_main)) in ctx.dependency_map {
+            let file = result.interner.intern(scan_interner.resolve(file));
+            let dependencies = dependencies
+                .iter()
+                .map(|&d| result.interner.intern(scan_interner.resolve(d)))
+                .collect();
+            result.dependency_map.insert(file, (dependencies, has_main));
+        }
+
+        for dll in ctx.dlls {
+            if !result.dlls.contains(&dll) {
+                result.dlls.push(dll);
             }
         }
 
-        Ok(ParseResult::new(dependency_map, dlls))
+        Ok(())
+    }
+
+    fn scan_mode(&self) -> &'static str {
+        if self.cli.preamble_scan {
+            "preamble"
+        } else {
+            "full"
+        }
+    }
+
+    // Drops a deleted file from the parse result. Dangling include edges are
+    // tolerated by the generator and disappear on the next full parse.
+    pub fn remove_file(&self, filename: &Path, result: &mut ParseResult) {
+        if let Some(id) = result.interner.get(filename.to_str().unwrap()) {
+            result.dependency_map.remove(&id);
+        }
+    }
+}
+
+// Zero-length files cannot be mapped, so they fall back to an empty slice.
+enum FileContents {
+    Mapped(Mmap),
+    Empty,
+}
+
+impl std::ops::Deref for FileContents {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            FileContents::Mapped(map) => &map[..],
+            FileContents::Empty => &[],
+        }
+    }
+}
+
+// Maps the file contents into the address space instead of reading them onto
+// the heap; the scanner only ever borrows byte slices out of the mapping.
+fn map_file(filename: &Path) -> Result<FileContents, ScanError> {
+    let file = fs::File::open(filename)?;
+    if file.metadata()?.len() == 0 {
+        return Ok(FileContents::Empty);
     }
+
+    let map = unsafe { Mmap::map(&file)? };
+    Ok(FileContents::Mapped(map))
 }
 
 #[derive(Debug, Eq, PartialEq)]
@@ -94,14 +434,14 @@ enum IncludeFile<'i> {
     User(&'i str),
 }
 
-fn extract_include_filename(line: &str) -> IncludeFile<'_> {
-    let (start_index, end_index) = (line.find('<'), line.find('>'));
+fn extract_include_filename(line: &[u8]) -> IncludeFile<'_> {
+    let (start_index, end_index) = (memchr(b'<', line), memchr(b'>', line));
 
     let mut is_system_file = true;
     let (start_index, end_index) = if start_index.is_none() || end_index.is_none() {
-        let start_index = line.find('"').unwrap();
+        let start_index = memchr(b'"', line).unwrap();
         let start_pos = start_index + 1;
-        let end_index = line[start_pos..].find('"').unwrap();
+        let end_index = memchr(b'"', &line[start_pos..]).unwrap();
         let end_index = start_pos + end_index;
         is_system_file = false;
         (start_index, end_index)
@@ -109,7 +449,9 @@ fn extract_include_filename(line: &str) -> IncludeFile<'_> {
         (start_index.unwrap(), end_index.unwrap())
     };
 
-    let include_file = &line[(start_index + 1)..end_index];
+    // Only the filename between the delimiters is UTF-8 validated; the rest of
+    // the mapped file is never copied or inspected as a string.
+    let include_file = std::str::from_utf8(&line[(start_index + 1)..end_index]).unwrap();
 
     if is_system_file {
         IncludeFile::System(include_file)
@@ -118,66 +460,327 @@ fn extract_include_filename(line: &str) -> IncludeFile<'_> {
     }
 }
 
-fn get_include_files_and_update_dlls(source: &str, dlls: &mut Vec<String>) -> Vec<String> {
+// Yields each #include directive line without visiting non-directive bytes:
+// candidate positions come from a vectorized '#' search, and a candidate only
+// counts when nothing but whitespace sits between it and its line start.
+fn include_directive_lines<'s>(source: &'s [u8]) -> impl Iterator<Item = &'s [u8]> {
+    memchr_iter(b'#', source).filter_map(move |hash_pos| {
+        let line_start = memrchr(b'\n', &source[..hash_pos]).map_or(0, |p| p + 1);
+        if !source[line_start..hash_pos]
+            .iter()
+            .all(u8::is_ascii_whitespace)
+        {
+            return None;
+        }
+
+        let line_end = memchr(b'\n', &source[hash_pos..]).map_or(source.len(), |p| hash_pos + p);
+        let line = &source[hash_pos..line_end];
+        if line.starts_with(b"#include") {
+            Some(line)
+        } else {
+            None
+        }
+    })
+}
+
+fn get_include_files_and_update_dlls(
+    source: &[u8],
+    dll_db: &DllDatabase,
+    dlls: &mut Vec<String>,
+) -> Vec<String> {
     let mut include_files = Vec::new();
-    source
-        .lines()
-        .filter(|line| line.trim_start().starts_with("#include"))
-        .for_each(|line| {
-            let include_file = extract_include_filename(line);
-            match include_file {
-                IncludeFile::System(include_file) => {
-                    if DLL_MAP.contains_key(include_file) {
-                        let linkage_name = DLL_MAP.get(include_file).unwrap().to_string();
-                        if !dlls.contains(&linkage_name) {
-                            dlls.push(linkage_name);
-                        }
+    include_directive_lines(source).for_each(|line| {
+        let include_file = extract_include_filename(line);
+        match include_file {
+            IncludeFile::System(include_file) => {
+                if let Some(linkage_name) = dll_db.lookup(include_file) {
+                    if !dlls.iter().any(|d| d == linkage_name) {
+                        dlls.push(linkage_name.to_string());
                     }
                 }
-                IncludeFile::User(include_file) => {
-                    include_files.push(include_file.to_string());
-                }
             }
-        });
+            IncludeFile::User(include_file) => {
+                include_files.push(include_file.to_string());
+            }
+        }
+    });
 
     include_files
 }
 
-fn read_file_and_get_include_files_recursively(
-    root_dir: &PathBuf,
+// Scans a file and everything transitively reachable through its includes.
+// The traversal is an explicit frontier worklist rather than recursion, so a
+// 200-level generated include chain costs heap instead of call stack, and
+// each wave of newly discovered files is visible as a batch (the natural spot
+// to hang read prefetching off later).
+fn read_file_and_get_include_files(
+    env: &ScanEnvironment,
     filename: &Path,
     ctx: &mut ParseContext,
-) -> Result<(), Box<dyn Error>> {
-    let contents = fs::read_to_string(filename)?;
-    let has_main = contents.contains("main(");
-    let mut include_files = get_include_files_and_update_dlls(&contents, ctx.dlls);
+) -> Result<(), ScanError> {
+    let mut frontier = vec![filename.to_path_buf()];
+    let mut next_frontier = Vec::new();
+
+    while !frontier.is_empty() {
+        for filename in frontier.drain(..) {
+            let filename_str = filename.to_str().unwrap().to_string();
+            let metadata = fs::metadata(env.root_dir.join(&filename))?;
+
+            // On a warm run most files hit the cache and are never opened or
+            // mapped; the cached include list is already root-relative.
+            let entry = match env.cache.lookup(&filename_str, &metadata) {
+                Some(entry) => {
+                    timings::record_parse_cache(true);
+                    entry.clone()
+                }
+                None => {
+                    timings::record_parse_cache(false);
+                    scan_file(env, &filename, &metadata, &mut ctx.resolution_cache)?
+                }
+            };
+
+            for dll in &entry.dlls {
+                ctx.push_dll(dll);
+            }
+
+            let include_ids: Vec<FileId> = entry
+                .includes
+                .iter()
+                .map(|include_file| ctx.interner.intern(include_file))
+                .collect();
+
+            for (include_file, &include_id) in entry.includes.iter().zip(&include_ids) {
+                if !ctx.dependency_map.contains_key(&include_id) && !ctx.seen.contains(&include_id)
+                {
+                    ctx.seen.insert(include_id);
+                    next_frontier.push(PathBuf::from(include_file));
+                }
+            }
+
+            let file_id = ctx.interner.intern(&filename_str);
+            ctx.dependency_map
+                .entry(file_id)
+                .or_insert((include_ids, entry.has_main));
+
+            ctx.cache_updates.insert(filename_str, entry);
+        }
+
+        std::mem::swap(&mut frontier, &mut next_frontier);
+    }
 
+    Ok(())
+}
+
+fn scan_file(
+    env: &ScanEnvironment,
+    filename: &Path,
+    metadata: &fs::Metadata,
+    resolution_cache: &mut ResolutionCache,
+) -> Result<CacheEntry, ScanError> {
+    let contents = map_file(&env.root_dir.join(filename))?;
+
+    // In preamble mode only the directive preamble is scanned for includes
+    // and the main() search is bounded to a window at each end of the file,
+    // so a multi-MB generated table costs a few pages instead of a full
+    // sweep.
+    let (include_region, has_main) = if env.preamble_scan {
+        let preamble = &contents[..preamble_end(&contents)];
+        (preamble, bounded_has_main(&contents))
+    } else {
+        (&contents[..], MAIN_FINDER.find(&contents).is_some())
+    };
+
+    let mut dlls = Vec::new();
+    let mut include_files = get_include_files_and_update_dlls(include_region, env.dll_db, &mut dlls);
+
+    timings::record_file_scanned(include_region.len() as u64, include_files.len() as u64);
+
+    let including_dir = filename.parent().unwrap_or_else(|| Path::new(""));
     for include_file in &mut include_files {
-        let mut full_path = root_dir.to_path_buf();
-        full_path.push(filename);
-        full_path.pop();
-        full_path.push(&include_file);
-        full_path = full_path.canonicalize()?;
+        *include_file =
+            resolve_include(env, including_dir, include_file, resolution_cache)?;
+    }
+
+    let (mtime_secs, mtime_nanos, size) = CacheEntry::stamp_of(metadata);
+
+    Ok(CacheEntry {
+        mtime_secs,
+        mtime_nanos,
+        size,
+        has_main,
+        includes: include_files,
+        dlls,
+    })
+}
 
-        *include_file = full_path
-            .strip_prefix(root_dir)?
-            .to_str()
-            .unwrap()
-            .to_string();
+// Byte window searched for a main() signature at each end of a file when
+// preamble scanning is on.
+const MAIN_SCAN_WINDOW: usize = 64 * 1024;
+
+// Finds where the directive preamble ends: the offset of the first line that
+// is not blank, a preprocessor directive or (the start or body of) a comment.
+// Only preamble lines are ever visited, so the cost is bounded by the
+// preamble length, not the file length.
+fn preamble_end(source: &[u8]) -> usize {
+    let mut offset = 0;
+    while offset < source.len() {
+        let line_end = memchr(b'\n', &source[offset..]).map_or(source.len(), |p| offset + p);
+        let line = &source[offset..line_end];
+        let trimmed_at = line
+            .iter()
+            .position(|b| !b.is_ascii_whitespace())
+            .unwrap_or(line.len());
+        let line = &line[trimmed_at..];
+
+        let is_preamble = line.is_empty()
+            || line[0] == b'#'
+            || line[0] == b'*'
+            || line.starts_with(b"//")
+            || line.starts_with(b"/*");
+
+        if !is_preamble {
+            return offset;
+        }
+
+        offset = line_end + 1;
+    }
+
+    source.len()
+}
 
-        if !ctx.dependency_map.contains_key(include_file) && !ctx.seen.contains(include_file) {
-            ctx.seen.insert(include_file.to_string());
-            read_file_and_get_include_files_recursively(root_dir, Path::new(include_file), ctx)?;
+// Bounded main() detection: searches a window at the head and tail of the
+// file and requires the match not to be the suffix of a longer identifier
+// (so `domain(` does not count as a main signature).
+fn bounded_has_main(source: &[u8]) -> bool {
+    let head = &source[..source.len().min(MAIN_SCAN_WINDOW)];
+    if find_main_signature(head) {
+        return true;
+    }
+
+    if source.len() > MAIN_SCAN_WINDOW {
+        // Overlap the windows by the needle length so a straddling match is
+        // still seen.
+        let tail_start = source
+            .len()
+            .saturating_sub(MAIN_SCAN_WINDOW + MAIN_FINDER.needle().len());
+        return find_main_signature(&source[tail_start..]);
+    }
+
+    false
+}
+
+fn find_main_signature(window: &[u8]) -> bool {
+    let mut offset = 0;
+    while let Some(position) = MAIN_FINDER.find(&window[offset..]) {
+        let absolute = offset + position;
+        let preceding = if absolute == 0 {
+            None
+        } else {
+            Some(window[absolute - 1])
+        };
+
+        match preceding {
+            Some(b) if b.is_ascii_alphanumeric() || b == b'_' => {}
+            _ => return true,
         }
+
+        offset = absolute + 1;
     }
 
-    let filename = filename.to_str().unwrap();
-    if !ctx.dependency_map.contains_key(filename) {
-        ctx.dependency_map
-            .insert(filename.to_string(), (include_files, has_main));
+    false
+}
+
+// Resolves an include to its root-relative path. A pure lexical
+// normalization plus one symlink_metadata probe replaces canonicalize's
+// lstat/readlink chain in the common symlink-free case, and every resolution
+// is cached per (including directory, include text) pair.
+fn resolve_include(
+    env: &ScanEnvironment,
+    including_dir: &Path,
+    include_text: &str,
+    cache: &mut ResolutionCache,
+) -> Result<String, ScanError> {
+    let key = (including_dir.to_path_buf(), include_text.to_string());
+    if let Some(resolved) = cache.resolved.get(&key) {
+        timings::record_resolution_cache(true);
+        return Ok(resolved.clone());
     }
+    timings::record_resolution_cache(false);
+
+    // Quoted-include semantics: the including file's own directory wins,
+    // then the -I search directories in the order they were given.
+    let resolved = probe_directory(env.root_dir, including_dir, include_text, &mut cache.probes)
+        .or_else(|| {
+            env.include_dirs.iter().find_map(|dir| {
+                probe_directory(env.root_dir, Path::new(dir), include_text, &mut cache.probes)
+            })
+        });
 
-    Ok(())
+    let resolved = match resolved {
+        Some(resolved) => resolved,
+        // No probe found a regular file; fall back to the canonicalize
+        // chain, which still resolves paths whose `..` components cross
+        // symlinks (invisible to the lexical probes).
+        None => {
+            timings::record_canonicalize();
+            let mut full_path = env.root_dir.join(including_dir);
+            full_path.push(include_text);
+            full_path
+                .canonicalize()?
+                .strip_prefix(env.root_dir)?
+                .to_str()
+                .unwrap()
+                .to_string()
+        }
+    };
+
+    cache.resolved.insert(key, resolved.clone());
+    Ok(resolved)
+}
+
+// Stats one candidate directory for an include, with the outcome -- hit or
+// miss -- remembered per (directory, include name) pair.
+fn probe_directory(
+    root_dir: &Path,
+    directory: &Path,
+    include_text: &str,
+    probes: &mut HashMap<(PathBuf, String), Option<String>>,
+) -> Option<String> {
+    let key = (directory.to_path_buf(), include_text.to_string());
+    if let Some(cached) = probes.get(&key) {
+        return cached.clone();
+    }
+
+    let mut full_path = root_dir.join(directory);
+    full_path.push(include_text);
+    let normalized = normalize_lexically(&full_path);
+
+    let result = match fs::symlink_metadata(&normalized) {
+        Ok(metadata) if metadata.file_type().is_file() => normalized
+            .strip_prefix(root_dir)
+            .ok()
+            .and_then(Path::to_str)
+            .map(str::to_string),
+        _ => None,
+    };
+
+    probes.insert(key, result.clone());
+    result
+}
+
+fn normalize_lexically(path: &Path) -> PathBuf {
+    let mut normalized = PathBuf::new();
+    for component in path.components() {
+        match component {
+            Component::CurDir => {}
+            Component::ParentDir => {
+                normalized.pop();
+            }
+            component => normalized.push(component),
+        }
+    }
+
+    normalized
 }
 
 #[cfg(test)]
@@ -200,7 +803,7 @@ mod tests {
         let includes: Vec<_> = source
             .lines()
             .filter(|l| l.trim_start().starts_with("#include"))
-            .map(|l| extract_include_filename(l))
+            .map(|l| extract_include_filename(l.as_bytes()))
             .collect();
 
         assert_eq!(
@@ -230,9 +833,24 @@ mod tests {
         "##;
 
         let mut dlls = Vec::new();
-        let include_files = get_include_files_and_update_dlls(source, &mut dlls);
+        let include_files =
+            get_include_files_and_update_dlls(source.as_bytes(), &DllDatabase::default(), &mut dlls);
 
         assert_eq!(include_files, vec!["my_header.h", "string_interning.h"]);
         assert_eq!(dlls, vec!["m", "pthread"]);
     }
+
+    #[test]
+    fn user_dll_mappings_override_builtins() {
+        let db = DllDatabase::from_contents(
+            "# project overrides\n\
+             math.h = openlibm\n\
+             my/driver.h = mydriver\n",
+        );
+
+        assert_eq!(db.lookup("math.h"), Some("openlibm"));
+        assert_eq!(db.lookup("my/driver.h"), Some("mydriver"));
+        assert_eq!(db.lookup("zlib.h"), Some("z"));
+        assert_eq!(db.lookup("stdio.h"), None);
+    }
 }
@@ -0,0 +1,151 @@
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::Instant;
+
+// All counters are process-global atomics behind one enabled flag, so with
+// --timings off every hot-path hook is a single relaxed load and a predicted
+// branch; no counter is touched and no lock is taken.
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+static FILES_SCANNED: AtomicU64 = AtomicU64::new(0);
+static BYTES_SCANNED: AtomicU64 = AtomicU64::new(0);
+static INCLUDE_EDGES: AtomicU64 = AtomicU64::new(0);
+static PARSE_CACHE_HITS: AtomicU64 = AtomicU64::new(0);
+static PARSE_CACHE_MISSES: AtomicU64 = AtomicU64::new(0);
+static RESOLUTION_CACHE_HITS: AtomicU64 = AtomicU64::new(0);
+static RESOLUTION_CACHE_MISSES: AtomicU64 = AtomicU64::new(0);
+static CANONICALIZE_CALLS: AtomicU64 = AtomicU64::new(0);
+static UNCHANGED_MAKEFILES: AtomicU64 = AtomicU64::new(0);
+
+lazy_static! {
+    // Coarse per-phase wall times; phases are few, so a mutex is fine here.
+    static ref PHASES: Mutex<Vec<(&'static str, f64)>> = Mutex::new(Vec::new());
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum TimingsFormat {
+    Text,
+    Json,
+}
+
+pub fn enable() {
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+#[inline]
+fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+#[inline]
+fn bump(counter: &AtomicU64, amount: u64) {
+    if enabled() {
+        counter.fetch_add(amount, Ordering::Relaxed);
+    }
+}
+
+#[inline]
+pub fn record_file_scanned(bytes: u64, include_edges: u64) {
+    bump(&FILES_SCANNED, 1);
+    bump(&BYTES_SCANNED, bytes);
+    bump(&INCLUDE_EDGES, include_edges);
+}
+
+#[inline]
+pub fn record_parse_cache(hit: bool) {
+    bump(if hit { &PARSE_CACHE_HITS } else { &PARSE_CACHE_MISSES }, 1);
+}
+
+#[inline]
+pub fn record_resolution_cache(hit: bool) {
+    bump(
+        if hit {
+            &RESOLUTION_CACHE_HITS
+        } else {
+            &RESOLUTION_CACHE_MISSES
+        },
+        1,
+    );
+}
+
+#[inline]
+pub fn record_canonicalize() {
+    bump(&CANONICALIZE_CALLS, 1);
+}
+
+#[inline]
+pub fn record_unchanged_makefile() {
+    bump(&UNCHANGED_MAKEFILES, 1);
+}
+
+// Runs a pipeline phase, recording its wall time when timings are on.
+pub fn time_phase<T>(name: &'static str, phase: impl FnOnce() -> T) -> T {
+    if !enabled() {
+        return phase();
+    }
+
+    let start = Instant::now();
+    let result = phase();
+    let elapsed_ms = start.elapsed().as_secs_f64() * 1000.0;
+    PHASES.lock().unwrap().push((name, elapsed_ms));
+    result
+}
+
+fn counters() -> Vec<(&'static str, u64)> {
+    vec![
+        ("files_scanned", FILES_SCANNED.load(Ordering::Relaxed)),
+        ("bytes_scanned", BYTES_SCANNED.load(Ordering::Relaxed)),
+        ("include_edges", INCLUDE_EDGES.load(Ordering::Relaxed)),
+        ("parse_cache_hits", PARSE_CACHE_HITS.load(Ordering::Relaxed)),
+        (
+            "parse_cache_misses",
+            PARSE_CACHE_MISSES.load(Ordering::Relaxed),
+        ),
+        (
+            "resolution_cache_hits",
+            RESOLUTION_CACHE_HITS.load(Ordering::Relaxed),
+        ),
+        (
+            "resolution_cache_misses",
+            RESOLUTION_CACHE_MISSES.load(Ordering::Relaxed),
+        ),
+        (
+            "canonicalize_calls",
+            CANONICALIZE_CALLS.load(Ordering::Relaxed),
+        ),
+        (
+            "unchanged_makefiles",
+            UNCHANGED_MAKEFILES.load(Ordering::Relaxed),
+        ),
+    ]
+}
+
+pub fn report(format: TimingsFormat) {
+    let phases = PHASES.lock().unwrap();
+
+    match format {
+        TimingsFormat::Text => {
+            eprintln!("makegen timings:");
+            for (name, elapsed_ms) in phases.iter() {
+                eprintln!("  {:<24} {:>10.3} ms", name, elapsed_ms);
+            }
+            for (name, value) in counters() {
+                eprintln!("  {:<24} {:>10}", name, value);
+            }
+        }
+        TimingsFormat::Json => {
+            // Keys and values are plain identifiers and numbers, so the JSON
+            // is assembled by hand rather than pulling in a serializer.
+            let mut fields: Vec<String> = phases
+                .iter()
+                .map(|(name, elapsed_ms)| format!("\"{}_ms\":{:.3}", name, elapsed_ms))
+                .collect();
+            fields.extend(
+                counters()
+                    .iter()
+                    .map(|(name, value)| format!("\"{}\":{}", name, value)),
+            );
+            println!("{{{}}}", fields.join(","));
+        }
+    }
+}
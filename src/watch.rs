@@ -0,0 +1,68 @@
+use crate::{cli::Cli, filename_utils::*, generate::generate_makefile, parser::Parser};
+use notify::{watcher, DebouncedEvent, RecursiveMode, Watcher};
+use std::{
+    error::Error,
+    path::{Path, PathBuf},
+    sync::mpsc,
+    time::{Duration, Instant},
+};
+
+// Notifications for unrelated files (the Makefile itself, the cache, editor
+// droppings) arrive constantly; only source and header changes matter.
+fn is_relevant(path: &Path, root_dir: &Path, cli: &Cli) -> bool {
+    path.strip_prefix(root_dir)
+        .map(|relative| {
+            !relative
+                .components()
+                .any(|c| c.as_os_str().to_str().map_or(true, |s| s.starts_with('.')))
+        })
+        .unwrap_or(false)
+        && (has_extension(path, cli.extension) || has_extension(path, "h"))
+}
+
+// Stays resident, patches the in-memory dependency graph on every relevant
+// filesystem event and re-emits the Makefile, instead of paying the full
+// walk-and-parse cost per regeneration.
+pub fn watch(root_dir: PathBuf, cli: &Cli) -> Result<(), Box<dyn Error>> {
+    let parser = Parser::new(root_dir.clone(), cli);
+    let mut parse_result = parser.parse()?;
+    generate_makefile(cli, &parse_result, &root_dir)?;
+
+    let (tx, rx) = mpsc::channel();
+    let mut watcher = watcher(tx, Duration::from_millis(50))?;
+    watcher.watch(&root_dir, RecursiveMode::Recursive)?;
+
+    println!("makegen: watching {} for changes", root_dir.display());
+
+    loop {
+        let (changed, removed) = match rx.recv()? {
+            DebouncedEvent::Create(path) | DebouncedEvent::Write(path) => (Some(path), None),
+            DebouncedEvent::Remove(path) => (None, Some(path)),
+            DebouncedEvent::Rename(from, to) => (Some(to), Some(from)),
+            _ => (None, None),
+        };
+
+        let mut dirty = false;
+
+        if let Some(path) = removed.filter(|p| is_relevant(p, &root_dir, cli)) {
+            parser.remove_file(path.strip_prefix(&root_dir)?, &mut parse_result);
+            dirty = true;
+        }
+
+        if let Some(path) = changed.filter(|p| is_relevant(p, &root_dir, cli)) {
+            let relative = path.strip_prefix(&root_dir)?.to_path_buf();
+            // A save can race the editor (half-written file, include target
+            // not on disk yet); skip this round and wait for the next event.
+            match parser.reparse_file(&relative, &mut parse_result) {
+                Ok(()) => dirty = true,
+                Err(e) => eprintln!("makegen: skipping {}: {}", relative.display(), e),
+            }
+        }
+
+        if dirty {
+            let start = Instant::now();
+            generate_makefile(cli, &parse_result, &root_dir)?;
+            println!("makegen: Makefile regenerated in {:?}", start.elapsed());
+        }
+    }
+}